@@ -0,0 +1,260 @@
+#!/usr/bin/env python
+
+#==============================================================================#
+# Autotune HAFT runtime knobs of a benchmark:
+#   - searches THRESHOLD x MAX_RETRIES (optionally FOOTPRINT_THRESHOLD) by
+#     successive halving: all candidates run once, the better half runs
+#     twice as often, ... until one candidate is left
+#   - no rebuilds: candidates are passed to the tx/haft binaries through
+#     $HAFT_CONFIG (see src/tx/runtime/tx_config.h)
+#   - best setting is written to <bench>/tune.<variant>.t<threads>.cfg, which
+#     the suite's run.sh picks up for that variant and number of threads
+#     (input is added to the name if it differs from the one of run.sh)
+#
+# Examples:
+#   ./autotune.py phoenix pca --variant haft --threads 8
+#   ./autotune.py parsec canneal --variant tx haft --build
+#==============================================================================#
+
+from __future__ import print_function
+
+import argparse
+import math
+import os
+import re
+import signal
+import subprocess
+import sys
+import tempfile
+import time
+
+HAFT = os.environ.get('HAFT', os.path.join(os.path.dirname(os.path.abspath(__file__)), '..'))
+
+SUITES = {
+    'phoenix': os.path.join(HAFT, 'src', 'benches', 'phoenix_pthread'),
+    'parsec':  os.path.join(HAFT, 'src', 'benches', 'parsec'),
+}
+
+# default inputs, same as in run.sh of each suite
+INPUTS = {
+    'phoenix': {
+        'histogram':            'input/large.bmp',
+        'kmeans':               '',
+        'kmeans_nosharing':     '',
+        'linear_regression':    'input/key_file_500MB.txt',
+        'matrix_multiply':      '1500',
+        'pca':                  '-r 3000 -c 3000',
+        'string_match':         'input/key_file_500MB.txt',
+        'word_count':           'input/word_100MB.txt',
+        'word_count_nosharing': '../word_count/input/word_100MB.txt',
+    },
+    'parsec': {
+        'blackscholes':  'native',
+        'ferret':        'native',
+        'swaptions':     'native',
+        'vips':          'native',
+        'x264':          'native',
+        'canneal':       'native',
+        'streamcluster': 'native',
+        'dedup':         'native',
+    },
+}
+
+PARSEC_ACTION = 'parsecperftx'
+
+PERF_TIME = re.compile(r'([0-9.]+) seconds time elapsed')
+
+
+def parse_list(s):
+    return [int(x) for x in s.split(',') if x]
+
+
+def build(suite, bench, variant):
+    benchdir = os.path.join(SUITES[suite], bench)
+    for target in ('clean', 'all'):
+        cmd = ['make', '-C', benchdir, 'ACTION=' + variant, target]
+        if subprocess.call(cmd) != 0:
+            sys.exit('build of %s (%s) failed' % (bench, variant))
+
+
+def command(suite, bench, variant, benchinput, threads):
+    taskset = ['taskset', '-c', '0-%d' % (threads - 1)]
+    if suite == 'phoenix':
+        cwd = os.path.join(SUITES[suite], bench)
+        exe = './%s.%s.exe' % (bench, variant)
+        return cwd, taskset + [exe] + benchinput.split()
+    cmd = ['parsecmgmt', '-a', 'run', '-p', bench, '-c', 'clang', '-s', PARSEC_ACTION,
+           '-i', '%s-%s' % (variant, benchinput), '-n', str(threads)]
+    return SUITES[suite], taskset + cmd
+
+
+def write_config(path, knobs, header=()):
+    with open(path, 'w') as f:
+        for line in header:
+            f.write('# %s\n' % line)
+        for name in sorted(knobs):
+            f.write('%s=%d\n' % (name, knobs[name]))
+
+
+def run_once(suite, bench, variant, benchinput, threads, knobs, timeout):
+    """Returns elapsed seconds, or None if the run failed or timed out."""
+    fd, cfg = tempfile.mkstemp(prefix='haft-tune-', suffix='.cfg')
+    os.close(fd)
+    write_config(cfg, knobs)
+    env = dict(os.environ)
+    env['HAFT_CONFIG'] = cfg
+
+    # output goes to a file, not a pipe: polling for the timeout below
+    # (no communicate(timeout) in Python 2) must not block on a full pipe
+    log = tempfile.TemporaryFile(prefix='haft-tune-', suffix='.log')
+    cwd, cmd = command(suite, bench, variant, benchinput, threads)
+    start = time.time()
+    try:
+        # own process group, so that a timeout also kills children
+        # (parsecmgmt, perf and the benchmark itself)
+        p = subprocess.Popen(cmd, cwd=cwd, env=env, stdout=log, stderr=subprocess.STDOUT,
+                             preexec_fn=os.setsid)
+        while p.poll() is None:
+            if timeout and time.time() - start > timeout:
+                os.killpg(p.pid, signal.SIGKILL)
+                p.wait()
+                print('%s: timed out after %.0fs' % (knobs_str(knobs), timeout))
+                return None
+            time.sleep(0.1)
+        elapsed = time.time() - start
+        log.seek(0)
+        out = log.read().decode('utf-8', 'replace')
+    except OSError as e:
+        print('cannot run %s: %s' % (' '.join(cmd), e))
+        return None
+    finally:
+        log.close()
+        os.remove(cfg)
+
+    if p.returncode != 0:
+        return None
+    # prefer time measured by perf (parsecmgmt also spends time on setup)
+    m = PERF_TIME.search(out)
+    if m:
+        return float(m.group(1))
+    return elapsed
+
+
+def median(samples):
+    s = sorted(samples)
+    n = len(s)
+    if n % 2:
+        return s[n // 2]
+    return (s[n // 2 - 1] + s[n // 2]) / 2.0
+
+
+def knobs_str(knobs):
+    return ' '.join('%s=%d' % (k[len('HAFT_'):], knobs[k]) for k in sorted(knobs))
+
+
+def successive_halving(candidates, measure, min_runs, eta):
+    """candidates: list of knob dicts; measure(knobs) -> seconds or None."""
+    samples = [[] for _ in candidates]
+    alive = list(range(len(candidates)))
+    runs = min_runs
+    rnd = 0
+    while True:
+        rnd += 1
+        print('--- round %d: %d candidates, %d runs each ---' % (rnd, len(alive), runs))
+        for i in alive:
+            while len(samples[i]) < runs:
+                t = measure(candidates[i])
+                if t is None:
+                    print('%s: failed, dropped' % knobs_str(candidates[i]))
+                    samples[i] = None
+                    break
+                samples[i].append(t)
+            if samples[i] is not None:
+                print('%s: median %.3fs over %d runs' % (knobs_str(candidates[i]), median(samples[i]), len(samples[i])))
+            sys.stdout.flush()
+
+        alive = [i for i in alive if samples[i] is not None]
+        if not alive:
+            return None, None
+        alive.sort(key=lambda i: median(samples[i]))
+        alive = alive[:int(math.ceil(len(alive) / float(eta)))]
+        if len(alive) == 1:
+            break
+        runs *= eta
+
+    best = alive[0]
+    return candidates[best], samples[best]
+
+
+def profile_name(args, variant):
+    """tune.<variant>.t<threads>.cfg; run.sh picks the one matching the
+    variant and thread count; a non-default input is added to the name, so
+    such profiles are never picked by run.sh."""
+    name = 'tune.%s.t%d' % (variant, args.threads)
+    if args.input != INPUTS[args.suite][args.bench]:
+        name += '.' + (re.sub(r'[^A-Za-z0-9]+', '_', args.input).strip('_') or 'noinput')
+    return name + '.cfg'
+
+
+def tune(args, variant):
+    candidates = []
+    for threshold in args.thresholds:
+        for retries in args.retries:
+            for footprint in (args.footprints or [None]):
+                knobs = {'HAFT_THRESHOLD': threshold, 'HAFT_MAX_RETRIES': retries}
+                if footprint is not None:
+                    knobs['HAFT_FOOTPRINT_THRESHOLD'] = footprint
+                candidates.append(knobs)
+
+    print('===== Tuning %s (%s, input: \'%s\', %d threads) =====' % (args.bench, variant, args.input, args.threads))
+    measure = lambda knobs: run_once(args.suite, args.bench, variant, args.input, args.threads, knobs, args.timeout)
+    best, samples = successive_halving(candidates, measure, args.min_runs, args.eta)
+    if best is None:
+        print('all candidates failed, no profile written')
+        return False
+
+    profile = os.path.join(SUITES[args.suite], args.bench, profile_name(args, variant))
+    header = [
+        'autotuned profile for %s (%s), used by run.sh via HAFT_CONFIG' % (args.bench, variant),
+        'input: \'%s\', threads: %d, median %.3fs over %d runs, %s' %
+            (args.input, args.threads, median(samples), len(samples), time.strftime('%Y-%m-%d')),
+    ]
+    write_config(profile, best, header)
+    print('best: %s -> %s' % (knobs_str(best), profile))
+    return True
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Autotune HAFT runtime knobs of a benchmark.')
+    parser.add_argument('suite', choices=sorted(SUITES))
+    parser.add_argument('bench')
+    parser.add_argument('--variant', nargs='+', choices=['tx', 'haft'], default=['haft'])
+    parser.add_argument('--input', help='benchmark input (default: same as run.sh)')
+    parser.add_argument('--threads', type=int, default=1)
+    parser.add_argument('--thresholds', type=parse_list, default=parse_list('250,500,1000,2000,4000,8000'))
+    parser.add_argument('--retries', type=parse_list, default=parse_list('1,2,4,8'))
+    parser.add_argument('--footprints', type=parse_list, default=None,
+                        help='also tune FOOTPRINT_THRESHOLD over these values')
+    parser.add_argument('--min-runs', type=int, default=1, help='runs per candidate in first round')
+    parser.add_argument('--eta', type=int, default=2, help='keep 1/eta of candidates per round')
+    parser.add_argument('--timeout', type=float, default=0, help='kill runs slower than this and treat them as failed (seconds)')
+    parser.add_argument('--build', action='store_true', help='(re)build variants before tuning')
+    args = parser.parse_args()
+
+    if args.bench not in INPUTS[args.suite]:
+        parser.error('unknown %s benchmark: %s' % (args.suite, args.bench))
+    if args.input is None:
+        args.input = INPUTS[args.suite][args.bench]
+    if args.eta < 2 or args.min_runs < 1 or args.threads < 1:
+        parser.error('need --eta >= 2, --min-runs >= 1, --threads >= 1')
+
+    ok = True
+    for variant in args.variant:
+        if args.build:
+            build(args.suite, args.bench, variant)
+        ok = tune(args, variant) and ok
+    return 0 if ok else 1
+
+
+if __name__ == '__main__':
+    sys.exit(main())
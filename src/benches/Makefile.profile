@@ -0,0 +1,38 @@
+MKFILE_PATH := $(dir $(abspath $(lastword $(MAKEFILE_LIST))))
+
+include $(MKFILE_PATH)/Makefile.common
+
+all:: $(NAME).profile.exe
+
+clean::
+	rm -f obj/$(NAME).native-linked.bc obj/$(NAME).native-renamed.bc obj/$(NAME).profile.bc
+	rm -f $(NAME).profile.exe $(NAME).profdata $(NAME).counts *.profraw
+
+# link all sources + utils
+obj/$(NAME).native-linked.bc: $(addprefix obj/, $(LLS)) $(UTILS)
+	$(LLVM_LINK) -o $@ $^
+
+# substitute libc functions + inline
+obj/$(NAME).native-renamed.bc: obj/$(NAME).native-linked.bc
+	$(LLVM_OPT) -load $(RENAME_PASSFILE) $(RENAME_PASSNAME) -inline $^ -o $@
+
+# IR-level instrumentation: same function names as seen by ILR pass
+obj/$(NAME).profile.bc: obj/$(NAME).native-renamed.bc
+	$(LLVM_OPT) -pgo-instr-gen -instrprof $^ -o $@
+
+# executable (writes default.profraw or $LLVM_PROFILE_FILE on exit)
+$(NAME).profile.exe: obj/$(NAME).profile.bc $(addprefix obj/, $(LLS2))
+	$(LLVM_CLANGPP) $(CCFLAGS) -fprofile-instr-generate -o $@ $^ -I $(INCLUDE_DIRS) -L $(LIB_DIRS) $(LIBS)
+
+# function counts for -ilr-profile ('<function> <count>' per line);
+# run $(NAME).profile.exe on representative inputs before 'make counts'
+.PHONY: counts
+counts: $(NAME).counts
+
+$(NAME).counts: $(wildcard *.profraw)
+	$(LLVM_PROFDATA) merge -o $(NAME).profdata $^
+	$(LLVM_PROFDATA) show -all-functions -counts $(NAME).profdata | \
+		awk '/^  [^ ].*:$$/ { if (name != "") print name, sum; name = $$1; sub(/:$$/, "", name); sum = 0 } \
+		     /Function count:/ { sum += $$3 } \
+		     /Block counts:/ { gsub(/[^0-9]+/, " "); for (i = 1; i <= NF; i++) sum += $$i } \
+		     END { if (name != "") print name, sum }' > $@
@@ -38,6 +38,9 @@ for bmidx in "${!benchmarks[@]}"; do
 
   for threads in "${threadsarr[@]}"; do
     for type in "${typesarr[@]}"; do
+      # autotuned runtime knobs (install/autotune.py), if any
+      if [ -f ${bm}/tune.${type}.t${threads}.cfg ]; then export HAFT_CONFIG=$(pwd)/${bm}/tune.${type}.t${threads}.cfg; else unset HAFT_CONFIG; fi
+
       echo "--- Running ${bm} ${threads} ${type} (input: ${benchinput}) ---"
       lastthreadid=$((threads-1))
       taskset -c 0-${lastthreadid} parsecmgmt -a run -p ${bm} -c clang -s "${action}" -i ${type}-${benchinput} -n ${threads}
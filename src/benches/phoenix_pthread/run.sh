@@ -72,6 +72,9 @@ for bmidx in "${!benchmarks[@]}"; do
   for threads in "${threadsarr[@]}"; do
     for type in "${typesarr[@]}"; do
 
+      # autotuned runtime knobs (install/autotune.py), if any
+      if [ -f tune.${type}.t${threads}.cfg ]; then export HAFT_CONFIG=$(pwd)/tune.${type}.t${threads}.cfg; else unset HAFT_CONFIG; fi
+
       echo "--- Running ${bm} ${threads} ${type} (input: '${in}') ---"
       lastthreadid=$((threads-1))
       ${action} taskset -c 0-${lastthreadid} ./${bm}.${type}.exe ${in}
@@ -0,0 +1,18 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+// printf in a loop must not split Tx: my_printf formats via vsnprintf
+// (Tx-safe with HTM) and defers its output until commit via tx_write;
+// 'make ACTION=tx check' verifies that no Tx-end is emitted on this path
+int main(int argc, char** argv) {
+  long i, n = 1000;
+  long sum = 0;
+
+  if (argc > 1)
+    n = atol(argv[1]);
+  for (i = 0; i < n; i++) {
+    sum += i * i;
+    printf("%ld %ld\n", i, sum);
+  }
+  return 0;
+}
@@ -0,0 +1,16 @@
+#include "my_alloc.h"
+
+extern void *my_malloc(size_t n);
+
+void *my_calloc(size_t nmemb, size_t size)
+{
+	size_t n = nmemb * size;
+	void *p;
+
+	if (size && n / size != nmemb)
+		return NULL;  // overflow
+	p = my_malloc(n);
+	if (p)
+		my_memset(p, 0, n);
+	return p;
+}
@@ -0,0 +1,15 @@
+#include "my_stdio.h"
+
+int my_fprintf(FILE *f, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+	int fd = my_stream_fd(f);
+	va_start(ap, fmt);
+	if (fd < 0)
+		n = vfprintf(f, fmt, ap);
+	else
+		n = my_vdprintf(fd, fmt, ap);
+	va_end(ap);
+	return n;
+}
@@ -0,0 +1,11 @@
+#include "my_stdio.h"
+
+int my_fputc(int c, FILE *f)
+{
+	unsigned char ch = (unsigned char)c;
+	int fd = my_stream_fd(f);
+	if (fd < 0)
+		return fputc(c, f);
+	my_out(fd, &ch, 1);
+	return ch;
+}
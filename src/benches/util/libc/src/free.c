@@ -0,0 +1,36 @@
+#include "my_alloc.h"
+
+void my_free(void *p)
+{
+	struct my_block *b, *old;
+	struct my_alloc_owner *owner;
+
+	if (!p)
+		return;
+	if (!my_alloc_owned(p)) {
+		// allocated by libc (e.g., strdup), not by my_malloc
+		free(p);
+		return;
+	}
+
+	b = my_alloc_header(p);
+	if (b->cls == MY_ALLOC_LARGE) {
+		b->magic = 0;
+		free(b);
+		return;
+	}
+
+	owner = my_alloc_block_owner(b);
+	if (owner == my_alloc_self) {
+		*(struct my_block **)p = my_alloc_freelists[b->cls];
+		my_alloc_freelists[b->cls] = b;
+		return;
+	}
+
+	// block of another thread: push onto its remote list
+	old = __atomic_load_n(&owner->remote, __ATOMIC_RELAXED);
+	do {
+		*(struct my_block **)p = old;
+	} while (!__atomic_compare_exchange_n(&owner->remote, &old, b, 1,
+	                                      __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
@@ -0,0 +1,12 @@
+#include "my_stdio.h"
+
+size_t my_fwrite(const void *ptr, size_t size, size_t nmemb, FILE *f)
+{
+	int fd = my_stream_fd(f);
+	if (fd < 0)
+		return fwrite(ptr, size, nmemb, f);
+	if (size == 0 || nmemb == 0)
+		return 0;
+	my_out(fd, ptr, size * nmemb);
+	return nmemb;
+}
@@ -0,0 +1,149 @@
+#include <pthread.h>
+#include "my_alloc.h"
+
+__thread struct my_block *my_alloc_freelists[MY_ALLOC_CLASSES];
+__thread struct my_alloc_owner *my_alloc_self;
+
+// owners of exited threads, waiting for adoption
+static struct my_alloc_owner *my_alloc_orphans;
+static pthread_mutex_t my_alloc_orphans_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t my_alloc_once = PTHREAD_ONCE_INIT;
+static pthread_key_t my_alloc_key;
+
+// thread exit: save free lists and hand owner over to a future thread
+static void my_alloc_exit(void *arg)
+{
+	struct my_alloc_owner *o = arg;
+
+	my_memcpy(o->freelists, my_alloc_freelists, sizeof(my_alloc_freelists));
+	my_memset(my_alloc_freelists, 0, sizeof(my_alloc_freelists));
+	my_alloc_self = NULL;
+
+	pthread_mutex_lock(&my_alloc_orphans_lock);
+	o->next = my_alloc_orphans;
+	my_alloc_orphans = o;
+	pthread_mutex_unlock(&my_alloc_orphans_lock);
+}
+
+static void my_alloc_key_init(void)
+{
+	pthread_key_create(&my_alloc_key, my_alloc_exit);
+}
+
+// first refill of thread: adopt owner of exited thread or create new one
+static struct my_alloc_owner *my_alloc_init_thread(void)
+{
+	struct my_alloc_owner *o;
+
+	pthread_once(&my_alloc_once, my_alloc_key_init);
+	pthread_mutex_lock(&my_alloc_orphans_lock);
+	o = my_alloc_orphans;
+	if (o)
+		my_alloc_orphans = o->next;
+	pthread_mutex_unlock(&my_alloc_orphans_lock);
+
+	if (o) {
+		// free lists of thread are still empty: all its frees were remote
+		my_memcpy(my_alloc_freelists, o->freelists, sizeof(my_alloc_freelists));
+	} else {
+		o = malloc(sizeof(*o));
+		if (!o)
+			return NULL;
+		my_memset(o, 0, sizeof(*o));
+	}
+	my_alloc_self = o;
+	pthread_setspecific(my_alloc_key, o);
+	return o;
+}
+
+// move blocks freed by other threads into free lists of this thread
+static void my_alloc_drain(struct my_alloc_owner *o)
+{
+	struct my_block *b = __atomic_exchange_n(&o->remote, NULL, __ATOMIC_ACQUIRE);
+	while (b) {
+		struct my_block *next = *(struct my_block **)(b + 1);
+		*(struct my_block **)(b + 1) = my_alloc_freelists[b->cls];
+		my_alloc_freelists[b->cls] = b;
+		b = next;
+	}
+}
+
+// map arena aligned to its size, so that owner is found from block address
+static char *my_alloc_map_arena(struct my_alloc_owner *o)
+{
+	char *p, *arena;
+
+	p = mmap(NULL, 2 * MY_ALLOC_ARENA_SIZE, PROT_READ | PROT_WRITE,
+	         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+		return NULL;
+	arena = (char *)(((uintptr_t)p + MY_ALLOC_ARENA_SIZE - 1) & ~(MY_ALLOC_ARENA_SIZE - 1));
+	if (arena > p)
+		munmap(p, arena - p);
+	munmap(arena + MY_ALLOC_ARENA_SIZE, p + MY_ALLOC_ARENA_SIZE - arena);
+
+	((struct my_arena *)arena)->owner = o;
+	return arena;
+}
+
+// slow path: take block of class cls from remote frees or carve it from
+// arena (mmap new arena if needed)
+void *my_alloc_refill(size_t cls)
+{
+	size_t blocksize = sizeof(struct my_block) + my_alloc_class_size(cls);
+	struct my_alloc_owner *o = my_alloc_self;
+	struct my_block *b;
+
+	if (!o) {
+		o = my_alloc_init_thread();
+		if (!o)
+			return NULL;
+	}
+	if (o->remote)
+		my_alloc_drain(o);
+	b = my_alloc_freelists[cls];
+	if (b) {
+		my_alloc_freelists[cls] = *(struct my_block **)(b + 1);
+		return b + 1;
+	}
+
+	if (o->arena_ptr + blocksize > o->arena_end) {
+		char *arena = my_alloc_map_arena(o);
+		if (!arena)
+			return NULL;
+		o->arena_ptr = arena + sizeof(struct my_arena);
+		o->arena_end = arena + MY_ALLOC_ARENA_SIZE;
+	}
+
+	b = (struct my_block *)o->arena_ptr;
+	o->arena_ptr += blocksize;
+	b->magic = MY_ALLOC_MAGIC ^ (uintptr_t)b;
+	b->cls = cls;
+	return b + 1;
+}
+
+void *my_malloc(size_t n)
+{
+	size_t cls = my_alloc_class(n);
+	struct my_block *b;
+
+	if (cls == MY_ALLOC_LARGE) {
+		// large block: libc malloc with our header
+		if (n > MY_ALLOC_LARGE_MAX) {
+			errno = ENOMEM;
+			return NULL;
+		}
+		b = malloc(sizeof(struct my_block) + n);
+		if (!b)
+			return NULL;
+		b->magic = MY_ALLOC_MAGIC ^ (uintptr_t)b;
+		b->cls = MY_ALLOC_LARGE;
+		return b + 1;
+	}
+
+	b = my_alloc_freelists[cls];
+	if (!b)
+		return my_alloc_refill(cls);
+	my_alloc_freelists[cls] = *(struct my_block **)(b + 1);
+	return b + 1;
+}
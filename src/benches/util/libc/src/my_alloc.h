@@ -0,0 +1,96 @@
+#ifndef MY_ALLOC_H
+#define MY_ALLOC_H
+
+// Thread-local size-class allocator for my_malloc & co.: small blocks come
+// from per-thread free lists refilled from per-thread arenas, so the fast
+// path has no syscalls and no atomics and can run inside transactions (and
+// be hardened by ILR). Arenas are allocated with mmap (slow path); large
+// blocks and blocks not allocated by us (e.g., by libc strdup) are handled
+// by libc malloc/free.
+//
+// Each thread owns the arenas it carves blocks from. Arenas are aligned to
+// their size and start with a pointer to their owner, so my_free can tell
+// blocks of other threads: these are pushed onto the remote list of their
+// owner (one atomic op), which the owner drains into its free lists on
+// refill. At thread exit, the owner with its free lists and arena is handed
+// over to the next thread that starts allocating.
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#define MY_ALLOC_CLASSES    9              // 16 B .. 4 KB
+#define MY_ALLOC_MIN_SHIFT  4
+#define MY_ALLOC_LARGE      MY_ALLOC_CLASSES
+#define MY_ALLOC_ARENA_SIZE (1UL << 20)
+#define MY_ALLOC_MAGIC      0x4841465461726e61UL
+
+// header keeps payload 16-byte aligned
+struct my_block {
+	uintptr_t magic;   // MY_ALLOC_MAGIC ^ address of block
+	size_t    cls;     // size class or MY_ALLOC_LARGE
+	// payload follows; while free, its first word links free list
+};
+
+// largest large block whose size with header does not overflow size_t
+#define MY_ALLOC_LARGE_MAX  (SIZE_MAX - sizeof(struct my_block))
+
+// allocator state of a thread (or of an exited thread, until adopted)
+struct my_alloc_owner {
+	struct my_block *remote;    // blocks freed by other threads
+	struct my_block *freelists[MY_ALLOC_CLASSES];  // saved at thread exit
+	char *arena_ptr;            // current arena
+	char *arena_end;
+	struct my_alloc_owner *next;  // list of owners of exited threads
+};
+
+// start of each arena, keeps blocks 16-byte aligned
+struct my_arena {
+	struct my_alloc_owner *owner;
+	uintptr_t pad;
+};
+
+extern __thread struct my_block *my_alloc_freelists[MY_ALLOC_CLASSES];
+extern __thread struct my_alloc_owner *my_alloc_self;
+
+extern void *my_alloc_refill(size_t cls);
+extern void *my_memcpy(void *dest, const void *src, size_t n);
+extern void *my_memset(void *dest, int c, size_t n);
+
+static inline size_t my_alloc_class(size_t n)
+{
+	size_t cls = 0;
+	size_t size = 1UL << MY_ALLOC_MIN_SHIFT;
+	while (size < n && cls < MY_ALLOC_CLASSES) {
+		size <<= 1;
+		cls++;
+	}
+	return cls;
+}
+
+static inline size_t my_alloc_class_size(size_t cls)
+{
+	return 1UL << (cls + MY_ALLOC_MIN_SHIFT);
+}
+
+static inline struct my_block *my_alloc_header(void *p)
+{
+	return (struct my_block *)p - 1;
+}
+
+// owner of small block b
+static inline struct my_alloc_owner *my_alloc_block_owner(struct my_block *b)
+{
+	return ((struct my_arena *)((uintptr_t)b & ~(MY_ALLOC_ARENA_SIZE - 1)))->owner;
+}
+
+// is p allocated by us?
+static inline int my_alloc_owned(void *p)
+{
+	struct my_block *b = my_alloc_header(p);
+	return b->magic == (MY_ALLOC_MAGIC ^ (uintptr_t)b);
+}
+
+#endif
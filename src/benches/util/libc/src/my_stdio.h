@@ -0,0 +1,55 @@
+#ifndef MY_STDIO_H
+#define MY_STDIO_H
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define PRINTF_BUFSIZE 1024
+
+// stdout buffer of my_printf & co. (see stdout.c)
+#define MY_STDOUT_BUFSIZE 4096
+
+extern long tx_write(int fd, const void *buf, unsigned long n);
+
+// buffered output to fd 1 (stdout) or unbuffered to other fds
+extern int my_out(int fd, const void *buf, unsigned long n);
+extern void my_stdout_flush(void);
+
+// fd of stdout/stderr, or -1 for other streams (not deferred)
+static inline int my_stream_fd(FILE *f)
+{
+	if (f == stdout) return 1;
+	if (f == stderr) return 2;
+	return -1;
+}
+
+// format into (stack) buffer and hand it over to my_out()
+static inline int my_vdprintf(int fd, const char *fmt, va_list ap)
+{
+	char buf[PRINTF_BUFSIZE];
+	char *out = buf;
+	va_list ap2;
+	int n;
+
+	va_copy(ap2, ap);
+	n = vsnprintf(buf, sizeof(buf), fmt, ap);
+	if (n >= (int)sizeof(buf)) {
+		// rare case of long output
+		out = malloc(n + 1);
+		if (!out) {
+			va_end(ap2);
+			return -1;
+		}
+		vsnprintf(out, n + 1, fmt, ap2);
+	}
+	va_end(ap2);
+
+	if (n > 0)
+		my_out(fd, out, n);
+	if (out != buf)
+		free(out);
+	return n;
+}
+
+#endif
@@ -0,0 +1,16 @@
+#include <errno.h>
+#include <string.h>
+#include "my_stdio.h"
+
+extern size_t my_strlen(const char *s);
+
+void my_perror(const char *s)
+{
+	const char *msg = strerror(errno);
+	if (s && *s) {
+		my_out(2, s, my_strlen(s));
+		my_out(2, ": ", 2);
+	}
+	my_out(2, msg, my_strlen(msg));
+	my_out(2, "\n", 1);
+}
@@ -0,0 +1,11 @@
+#include "my_stdio.h"
+
+int my_printf(const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+	va_start(ap, fmt);
+	n = my_vdprintf(1, fmt, ap);
+	va_end(ap);
+	return n;
+}
@@ -0,0 +1,8 @@
+#include "my_stdio.h"
+
+int my_putchar(int c)
+{
+	unsigned char ch = (unsigned char)c;
+	my_out(1, &ch, 1);
+	return ch;
+}
@@ -0,0 +1,60 @@
+#include "my_alloc.h"
+
+extern void *my_malloc(size_t n);
+extern void my_free(void *p);
+
+void *my_realloc(void *p, size_t n)
+{
+	struct my_block *b;
+	size_t oldsize;
+	void *q;
+
+	if (!p)
+		return my_malloc(n);
+	if (n == 0) {
+		my_free(p);
+		return NULL;
+	}
+	if (!my_alloc_owned(p))
+		return realloc(p, n);  // allocated by libc
+
+	b = my_alloc_header(p);
+	if (b->cls == MY_ALLOC_LARGE) {
+		struct my_block *nb;
+		if (my_alloc_class(n) != MY_ALLOC_LARGE) {
+			// shrinks to small block: move it into size class, old block
+			// stays valid if that fails
+			q = my_malloc(n);
+			if (!q)
+				return NULL;
+			my_memcpy(q, p, n);
+			b->magic = 0;
+			free(b);
+			return q;
+		}
+		if (n > MY_ALLOC_LARGE_MAX) {
+			errno = ENOMEM;
+			return NULL;  // old block stays valid
+		}
+		b->magic = 0;
+		nb = realloc(b, sizeof(struct my_block) + n);
+		if (!nb) {
+			// old block stays valid
+			b->magic = MY_ALLOC_MAGIC ^ (uintptr_t)b;
+			return NULL;
+		}
+		nb->magic = MY_ALLOC_MAGIC ^ (uintptr_t)nb;
+		return nb + 1;
+	}
+
+	oldsize = my_alloc_class_size(b->cls);
+	if (n <= oldsize)
+		return p;  // still fits
+
+	q = my_malloc(n);
+	if (!q)
+		return NULL;
+	my_memcpy(q, p, oldsize);
+	my_free(p);
+	return q;
+}
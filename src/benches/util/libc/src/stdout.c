@@ -0,0 +1,94 @@
+#include <errno.h>
+#include <unistd.h>
+#include "my_stdio.h"
+
+extern void *my_memcpy(void *dest, const void *src, size_t n);
+extern void *my_memchr(const void *src, int c, size_t n);
+
+// Output of my_printf & co. Like glibc, stdout is line-buffered on a
+// terminal and fully buffered otherwise, and stderr is unbuffered. The
+// buffer is flushed at exit and by my_fflush. All output goes through
+// tx_write(), which defers it until commit inside transactions.
+//
+// NOTE: buffer is guarded by a spinlock on atomics instead of a pthread
+//       mutex, which is an outside call and would end the current Tx
+static char my_stdout_buf[MY_STDOUT_BUFSIZE];
+static unsigned long my_stdout_len = 0;
+static int my_stdout_linebuf = 0;
+static int my_stdout_locked = 0;
+
+static inline void my_stdout_lock(void)
+{
+	while (__atomic_exchange_n(&my_stdout_locked, 1, __ATOMIC_ACQUIRE))
+		while (__atomic_load_n(&my_stdout_locked, __ATOMIC_RELAXED))
+			;
+}
+
+static inline void my_stdout_unlock(void)
+{
+	__atomic_store_n(&my_stdout_locked, 0, __ATOMIC_RELEASE);
+}
+
+__attribute__((constructor))
+static void my_stdout_init(void)
+{
+	int err = errno;
+	my_stdout_linebuf = isatty(1);
+	errno = err;
+}
+
+static void my_write_all(int fd, const char *buf, unsigned long n)
+{
+	while (n > 0) {
+		long r = tx_write(fd, buf, n);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r <= 0)
+			return;
+		buf += r;
+		n -= r;
+	}
+}
+
+static void my_stdout_flush_locked(void)
+{
+	if (my_stdout_len)
+		my_write_all(1, my_stdout_buf, my_stdout_len);
+	my_stdout_len = 0;
+}
+
+void my_stdout_flush(void)
+{
+	my_stdout_lock();
+	my_stdout_flush_locked();
+	my_stdout_unlock();
+}
+
+__attribute__((destructor))
+static void my_stdout_exit(void)
+{
+	my_stdout_flush();
+}
+
+int my_out(int fd, const void *buf, unsigned long n)
+{
+	if (fd != 1) {
+		my_write_all(fd, buf, n);
+		return n;
+	}
+
+	my_stdout_lock();
+	if (my_stdout_len + n > MY_STDOUT_BUFSIZE)
+		my_stdout_flush_locked();
+	if (n >= MY_STDOUT_BUFSIZE) {
+		// does not fit into empty buffer either
+		my_write_all(1, buf, n);
+	} else {
+		my_memcpy(my_stdout_buf + my_stdout_len, buf, n);
+		my_stdout_len += n;
+		if (my_stdout_linebuf && my_memchr(buf, '\n', n))
+			my_stdout_flush_locked();
+	}
+	my_stdout_unlock();
+	return n;
+}
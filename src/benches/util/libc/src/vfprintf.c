@@ -0,0 +1,9 @@
+#include "my_stdio.h"
+
+int my_vfprintf(FILE *f, const char *fmt, va_list ap)
+{
+	int fd = my_stream_fd(f);
+	if (fd < 0)
+		return vfprintf(f, fmt, ap);
+	return my_vdprintf(fd, fmt, ap);
+}
@@ -0,0 +1,6 @@
+#include "my_stdio.h"
+
+int my_vprintf(const char *fmt, va_list ap)
+{
+	return my_vdprintf(1, fmt, ap);
+}
@@ -0,0 +1,8 @@
+#include <unistd.h>
+
+extern long tx_write(int fd, const void *buf, unsigned long n);
+
+ssize_t my_write(int fd, const void *buf, size_t n)
+{
+	return tx_write(fd, buf, n);
+}
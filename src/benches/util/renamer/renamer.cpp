@@ -146,6 +146,45 @@ StringRef renameFunction(StringRef fname) {
 	if (fname.equals("hypot"))
 		return "my_hypot";
 
+	// memory allocation: thread-local arenas, no syscalls on fast path
+	if (fname.equals("malloc"))
+		return "my_malloc";
+	if (fname.equals("calloc"))
+		return "my_calloc";
+	if (fname.equals("realloc"))
+		return "my_realloc";
+	if (fname.equals("free"))
+		return "my_free";
+
+	// stdio funcs: the whole family writing to stdout/stderr is renamed,
+	// since my_* keep their own stdout buffer (see util/libc/src/stdout.c);
+	// output is deferred until Tx commit (see tx_write)
+	if (fname.equals("printf"))
+		return "my_printf";
+	if (fname.equals("fprintf"))
+		return "my_fprintf";
+	if (fname.equals("vprintf"))
+		return "my_vprintf";
+	if (fname.equals("vfprintf"))
+		return "my_vfprintf";
+	if (fname.equals("puts"))
+		return "my_puts";
+	if (fname.equals("fputs") || fname.equals("fputs_unlocked"))
+		return "my_fputs";
+	if (fname.equals("putchar") || fname.equals("putchar_unlocked"))
+		return "my_putchar";
+	if (fname.equals("fputc") || fname.equals("putc") || fname.equals("_IO_putc") ||
+	    fname.equals("fputc_unlocked") || fname.equals("putc_unlocked"))
+		return "my_fputc";
+	if (fname.equals("fwrite") || fname.equals("fwrite_unlocked"))
+		return "my_fwrite";
+	if (fname.equals("fflush") || fname.equals("fflush_unlocked"))
+		return "my_fflush";
+	if (fname.equals("perror"))
+		return "my_perror";
+	if (fname.equals("write"))
+		return "my_write";
+
 	return fname;
 }
 
@@ -163,7 +202,10 @@ class RenamerPass : public FunctionPass {
 	}
 
 	virtual bool runOnFunction(Function &F) {
-		F.getParent();
+		// substitutes themselves may call original funcs (e.g., fwrite on
+		// files other than stdout/stderr), do not introduce recursion
+		if (F.getName().startswith("my_") || F.getName().startswith("tx_"))
+			return false;
 
 		for (Function::iterator fi = F.begin(), fe = F.end(); fi != fe; ++fi) {
 			BasicBlock* BB = &*fi;
@@ -189,8 +231,12 @@ class RenamerPass : public FunctionPass {
 
 					IRBuilder<> irBuilder(I);
 
+					// variadic substitutes (my_printf) get all args of the call
+					unsigned numArgs = renamedfunc->isVarArg() ?
+						call->getNumArgOperands() : renamedfunc->arg_size();
+
 					std::vector<Value*> argsVec;
-					for (unsigned i = 0; i < renamedfunc->arg_size(); i++) {
+					for (unsigned i = 0; i < numArgs; i++) {
 						Value* arg = call->getArgOperand(i);
 						// corner-case: llvm.memset and libc memset differ in
 						// type of second arg -- i8 and i32 respectively;
@@ -29,6 +29,14 @@
 // via usual swift-check
 #define SWIFT_SIMPLE_CONTROL_FLOW
 
+// hoist swift-checks of loop-invariant values to loop preheaders and
+// replace checks of simple induction variables by one check on loop exit
+#define SWIFT_OPTIMIZE_LOOP_CHECKS
+
+// remove swift-checks dominated by an identical check on the same
+// master/shadow pair (e.g., a pointer passed to several calls in a row)
+#define SWIFT_OPTIMIZE_DOMINATED_CHECKS
+
 #include <llvm/Pass.h>
 #include <llvm/IR/PassManager.h>
 #include <llvm/IR/BasicBlock.h>
@@ -42,14 +50,25 @@
 #include <llvm/IR/DerivedTypes.h>
 #include <llvm/IR/Module.h>
 #include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/InstIterator.h>
 #include <llvm/Support/Casting.h>
 #include <llvm/IR/Dominators.h>
 #include <llvm/ADT/DepthFirstIterator.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/DenseSet.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/Statistic.h>
 #include <llvm/Transforms/Utils/BasicBlockUtils.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/Transforms/Utils/Local.h>
+#include <llvm/Analysis/AliasAnalysis.h>
 #include <llvm/Analysis/LoopInfo.h>
 #include <llvm/Analysis/LoopIterator.h>
 #include <llvm/Support/CommandLine.h>
+#include <llvm/Support/ErrorHandling.h>
 
+#include <algorithm>
+#include <fstream>
 #include <iostream>
 #include <map>
 #include <set>
@@ -60,6 +79,59 @@
 
 using namespace llvm;
 
+STATISTIC(ChecksEliminated, "Number of swift-checks removed as dominated by identical checks");
+STATISTIC(ResidueChecked, "Number of long-latency operations verified by residue checks");
+STATISTIC(ChecksHoisted, "Number of swift-checks on loop-invariant values hoisted to preheaders");
+STATISTIC(InductionChecksSunk, "Number of swift-checks on induction variables moved to loop exits");
+
+static cl::opt<bool>
+	SignatureChecks("ilr-signature", cl::Optional, cl::init(false),
+	cl::desc("Fold checks into a per-thread signature verified at Tx end (requires Tx pass with TX_ILR_SIGNATURE runtime)"));
+
+static cl::opt<bool>
+	SimdPack("ilr-simd-pack", cl::Optional, cl::init(false),
+	cl::desc("Replicate scalar arithmetic chains in two lanes of one SIMD vector (master in lane 0, shadow in lane 1)"));
+
+static cl::opt<bool>
+	DualCalls("ilr-dual-calls", cl::Optional, cl::init(false),
+	cl::desc("Pass shadow args and return shadow values of internal functions through calls instead of checking them"));
+
+static cl::opt<bool>
+	ResidueChecks("ilr-residue-checks", cl::Optional, cl::init(false),
+	cl::desc("Verify divisions and square roots by cheap algebraic checks instead of executing them twice"));
+
+enum StoreCheckMode {
+	STORE_CHECK_RELOAD,
+	STORE_CHECK_BATCHED,
+	STORE_CHECK_REGISTER
+};
+
+static cl::opt<StoreCheckMode>
+	StoreChecks("ilr-store-checks", cl::Optional, cl::init(STORE_CHECK_RELOAD),
+	cl::desc("How to verify regular (non-atomic) stores"),
+	cl::values(
+		clEnumValN(STORE_CHECK_RELOAD,   "reload",   "volatile reload after each store and check against shadow value"),
+		clEnumValN(STORE_CHECK_BATCHED,  "batched",  "reload stores of a BB at the next sync point and fold them into one check"),
+		clEnumValN(STORE_CHECK_REGISTER, "register", "check stored value and address against shadows before the store"),
+		clEnumValEnd));
+
+static cl::opt<std::string>
+	ProfileFile("ilr-profile", cl::Optional, cl::init(""),
+	cl::desc("Function counts file ('<function> <count>' per line) for profile-guided selective hardening"),
+	cl::value_desc("filename"));
+
+static cl::opt<unsigned>
+	OverheadBudget("ilr-overhead-budget", cl::Optional, cl::init(100),
+	cl::desc("Estimated slowdown (in percent) allowed for hardening when -ilr-profile is given"));
+
+static cl::opt<double>
+	FullCost("ilr-full-cost", cl::Optional, cl::init(1.0),
+	cl::desc("Estimated relative overhead of full replication of a function (1.0 = 2x slower)"));
+
+static cl::opt<double>
+	AddressCost("ilr-address-cost", cl::Optional, cl::init(0.3),
+	cl::desc("Estimated relative overhead of address-only replication of a function"));
+
 namespace {
 
 static const std::string CLONE_SUFFIX(".swift");
@@ -86,8 +158,13 @@ class SwiftHelpers {
 	public:
 	Type2FunctionMap movers;
 	Type2FunctionMap checkers;
+	Type2FunctionMap accumulators;
 	Function* detectedfunc;
 	std::set<Function*> helpers;
+
+	// internal functions and their clones with dual-value calling convention
+	std::map<Function*, Function*> dualFuncs;
+	std::set<Function*> dualClones;
 	Module* module;
 
 	SwiftHelpers(Module& M) {
@@ -102,6 +179,12 @@ class SwiftHelpers {
 		addFunction(M, checkers, "SWIFT$check_dq",     VectorType::get(Type::getInt64Ty(getGlobalContext()),  2));
 		addFunction(M, checkers, "SWIFT$check_pd",     VectorType::get(Type::getDoubleTy(getGlobalContext()), 2));
 		addFunction(M, checkers, "SWIFT$check_ps",     VectorType::get(Type::getFloatTy(getGlobalContext()),  4));
+		addFunction(M, checkers, "SWIFT$check_dq256",  VectorType::get(Type::getInt64Ty(getGlobalContext()),  4));
+		addFunction(M, checkers, "SWIFT$check_pd256",  VectorType::get(Type::getDoubleTy(getGlobalContext()), 4));
+		addFunction(M, checkers, "SWIFT$check_ps256",  VectorType::get(Type::getFloatTy(getGlobalContext()),  8));
+		addFunction(M, checkers, "SWIFT$check_dq512",  VectorType::get(Type::getInt64Ty(getGlobalContext()),  8));
+		addFunction(M, checkers, "SWIFT$check_pd512",  VectorType::get(Type::getDoubleTy(getGlobalContext()), 8));
+		addFunction(M, checkers, "SWIFT$check_ps512",  VectorType::get(Type::getFloatTy(getGlobalContext()), 16));
 
 		addFunction(M, movers, "SWIFT$move_i8",     Type::getInt8Ty(getGlobalContext()));
 		addFunction(M, movers, "SWIFT$move_i16",    Type::getInt16Ty(getGlobalContext()));
@@ -113,9 +196,38 @@ class SwiftHelpers {
 		addFunction(M, movers, "SWIFT$move_dq",     VectorType::get(Type::getInt64Ty(getGlobalContext()),  2));
 		addFunction(M, movers, "SWIFT$move_pd",     VectorType::get(Type::getDoubleTy(getGlobalContext()), 2));
 		addFunction(M, movers, "SWIFT$move_ps",     VectorType::get(Type::getFloatTy(getGlobalContext()),  4));
+		addFunction(M, movers, "SWIFT$move_dq256",  VectorType::get(Type::getInt64Ty(getGlobalContext()),  4));
+		addFunction(M, movers, "SWIFT$move_pd256",  VectorType::get(Type::getDoubleTy(getGlobalContext()), 4));
+		addFunction(M, movers, "SWIFT$move_ps256",  VectorType::get(Type::getFloatTy(getGlobalContext()),  8));
+		addFunction(M, movers, "SWIFT$move_dq512",  VectorType::get(Type::getInt64Ty(getGlobalContext()),  8));
+		addFunction(M, movers, "SWIFT$move_pd512",  VectorType::get(Type::getDoubleTy(getGlobalContext()), 8));
+		addFunction(M, movers, "SWIFT$move_ps512",  VectorType::get(Type::getFloatTy(getGlobalContext()), 16));
+
+		if (SignatureChecks) {
+			addFunction(M, accumulators, "SWIFT$accum_i8",     Type::getInt8Ty(getGlobalContext()));
+			addFunction(M, accumulators, "SWIFT$accum_i16",    Type::getInt16Ty(getGlobalContext()));
+			addFunction(M, accumulators, "SWIFT$accum_i32",    Type::getInt32Ty(getGlobalContext()));
+			addFunction(M, accumulators, "SWIFT$accum_i64",    Type::getInt64Ty(getGlobalContext()));
+			addFunction(M, accumulators, "SWIFT$accum_ptr",    PointerType::getUnqual(Type::getInt8Ty(getGlobalContext())));
+			addFunction(M, accumulators, "SWIFT$accum_double", Type::getDoubleTy(getGlobalContext()));
+			addFunction(M, accumulators, "SWIFT$accum_float",  Type::getFloatTy(getGlobalContext()));
+			addFunction(M, accumulators, "SWIFT$accum_dq",     VectorType::get(Type::getInt64Ty(getGlobalContext()),  2));
+			addFunction(M, accumulators, "SWIFT$accum_pd",     VectorType::get(Type::getDoubleTy(getGlobalContext()), 2));
+			addFunction(M, accumulators, "SWIFT$accum_ps",     VectorType::get(Type::getFloatTy(getGlobalContext()),  4));
+			addFunction(M, accumulators, "SWIFT$accum_dq256",  VectorType::get(Type::getInt64Ty(getGlobalContext()),  4));
+			addFunction(M, accumulators, "SWIFT$accum_pd256",  VectorType::get(Type::getDoubleTy(getGlobalContext()), 4));
+			addFunction(M, accumulators, "SWIFT$accum_ps256",  VectorType::get(Type::getFloatTy(getGlobalContext()),  8));
+			addFunction(M, accumulators, "SWIFT$accum_dq512",  VectorType::get(Type::getInt64Ty(getGlobalContext()),  8));
+			addFunction(M, accumulators, "SWIFT$accum_pd512",  VectorType::get(Type::getDoubleTy(getGlobalContext()), 8));
+			addFunction(M, accumulators, "SWIFT$accum_ps512",  VectorType::get(Type::getFloatTy(getGlobalContext()), 16));
+		}
 
 		detectedfunc = M.getFunction("SWIFT$detected");
 		assert(detectedfunc && "swift function <detected> not found (requires linked swift-interface");
+
+		// signature verifier is called by Tx runtime, must not be hardened itself
+		if (Function* verifyfunc = M.getFunction("SWIFT$verify"))
+			helpers.insert(verifyfunc);
 	}
 
 	// some functions-llvm intrinsics can be treated by swift as
@@ -181,6 +293,8 @@ class SwiftHelpers {
 			"tx_increment",
 			"tx_pthread_mutex_lock",
 			"tx_pthread_mutex_unlock",
+			"tx_pthread_spin_lock",
+			"tx_pthread_spin_unlock",
 
 			// Intel TSX intrinsics
 			"llvm.x86.xtest",
@@ -252,8 +366,107 @@ class SwiftHelpers {
 
 };
 
+enum HardeningLevel {
+	HARDEN_FULL,     // replicate all instructions, check stores/calls/branches
+	HARDEN_ADDRESS,  // replicate only address computations, check load/store addresses
+	HARDEN_NONE      // leave function as is
+};
+
+class HardeningPlan {
+	std::map<std::string, HardeningLevel> levels;
+
+	// profile names of local functions are prefixed by their file name
+	static std::string stripFilePrefix(const std::string& name) {
+		std::string::size_type pos = name.rfind(':');
+		if (pos == std::string::npos)
+			return name;
+		return name.substr(pos + 1);
+	}
+
+	struct FuncCost {
+		std::string name;
+		uint64_t weight;   // executed blocks in profile
+		double density;    // check sites per executed block
+	};
+
+	// sites checked in full mode: stores, calls, branches and returns
+	static unsigned countCheckSites(Function& F) {
+		unsigned sites = 0;
+		for (inst_iterator I = inst_begin(F), E = inst_end(F); I != E; ++I)
+			if (isa<StoreInst>(&*I) || isa<CallInst>(&*I) || isa<ReturnInst>(&*I) ||
+				(isa<BranchInst>(&*I) && cast<BranchInst>(&*I)->isConditional()))
+				sites++;
+		return sites;
+	}
+
+	public:
+	HardeningPlan(Module& M, SwiftHelpers* swiftHelpers) {
+		if (ProfileFile.empty())
+			return;
+
+		std::ifstream in(ProfileFile.c_str());
+		if (!in)
+			report_fatal_error(Twine("ILR: cannot open profile file ") + ProfileFile);
+
+		std::map<std::string, uint64_t> counts;
+		std::string name;
+		uint64_t count;
+		while (in >> name >> count)
+			counts[stripFilePrefix(name)] += count;
+
+		// weigh each hardenable function by its share of executed blocks
+		// (cost of hardening it) and count its check sites (coverage)
+		uint64_t total = 0;
+		std::vector<FuncCost> funcs;
+		for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
+			if (F->isDeclaration() || swiftHelpers->isIgnoredFunc(&*F))
+				continue;
+
+			std::map<std::string, uint64_t>::iterator it = counts.find(F->getName().str());
+			FuncCost fc;
+			fc.name = F->getName().str();
+			fc.weight = (it != counts.end()) ? it->second : 0;
+			fc.density = (double) countCheckSites(*F) / (fc.weight + 1);
+			funcs.push_back(fc);
+			total += fc.weight;
+		}
+		if (total == 0)
+			return;
+
+		// greedily harden functions with most checks per executed block
+		// first: they give most coverage for the least overhead; the rest
+		// get cheaper modes or none
+		std::sort(funcs.begin(), funcs.end(), [](const FuncCost& a, const FuncCost& b) {
+			return a.density > b.density;
+		});
+
+		double budget = OverheadBudget / 100.0;
+		double used = 0.0;
+		for (auto it = funcs.begin(); it != funcs.end(); ++it) {
+			double share = (double) it->weight / total;
+
+			HardeningLevel level = HARDEN_NONE;
+			if (used + FullCost * share <= budget) {
+				level = HARDEN_FULL;
+				used += FullCost * share;
+			} else if (used + AddressCost * share <= budget) {
+				level = HARDEN_ADDRESS;
+				used += AddressCost * share;
+			}
+			levels[it->name] = level;
+		}
+	}
+
+	HardeningLevel getLevel(Function* F) {
+		std::map<std::string, HardeningLevel>::iterator it = levels.find(F->getName().str());
+		if (it == levels.end())
+			return HARDEN_FULL;
+		return it->second;
+	}
+};
+
 class ValueShadowMap{
-	typedef std::map<Value*, Value*> ValueShadowMapType;
+	typedef DenseMap<Value*, Value*> ValueShadowMapType;
 	ValueShadowMapType vsm;
 
 	public:
@@ -287,6 +500,12 @@ class ValueShadowMap{
 	bool hasShadow(Value *v) {
 		return vsm.end() != vsm.find(v);
 	}
+
+	// forget v before it is erased, so that a new value at the same
+	// address does not inherit its shadow
+	void erase(Value* v) {
+		vsm.erase(v);
+	}
 };
 
 class SwiftTransformer {
@@ -296,6 +515,29 @@ class SwiftTransformer {
 	std::vector<BranchInst*> brs;
 	BasicBlock* detectedBB = nullptr;
 
+	// SIMD-packed replication: master value (lane 0) -> <2 x T> vector
+	DenseMap<Value*, Value*> packed;
+
+	// address-only replication: only values in addressSlice are shadowed
+	bool addressOnly = false;
+	DenseSet<Value*> addressSlice;
+
+	// batched store checks: stores of current BB not yet verified
+	struct PendingStore {
+		StoreInst* store;
+		Value* shadowptr;
+		Value* shadowval;
+	};
+	std::vector<PendingStore> pendingStores;
+	AAResults* AA = nullptr;
+
+	// calls replaced by calls to dual-value clones, erased at the end
+	std::vector<CallInst*> deadCalls;
+
+	// all inserted checks with their original master/shadow pair
+	typedef std::pair<Value*, Value*> CheckKey;
+	std::vector<std::pair<CallInst*, CheckKey> > checks;
+
 	unsigned long next_id = 0;
 
 	Value* castToSupportedType(IRBuilder<>& irBuilder, Value* v) {
@@ -348,6 +590,16 @@ class SwiftTransformer {
 				Type* TyVecDouble = VectorType::get(Type::getDoubleTy(getGlobalContext()), 2);
 
 				Type* VecTy = Ty->getVectorElementType();
+				unsigned VecBits = Ty->getPrimitiveSizeInBits();
+				if (VecBits == 256 || VecBits == 512) {
+					// AVX/AVX-512 vectors: floats and doubles have their own helpers,
+					// other vectors are reinterpreted as <4 x i64> or <8 x i64>
+					if (!VecTy->isFloatTy() && !VecTy->isDoubleTy()) {
+						Type* TyVecWideInt64 = VectorType::get(Type::getInt64Ty(getGlobalContext()), VecBits / 64);
+						if (Ty != TyVecWideInt64)
+							v = irBuilder.CreateBitCast(v, TyVecWideInt64, "swift.intveccast");
+					}
+				} else
 				if (VecTy->isIntegerTy() && Ty != TyVecInt64) {
 					unsigned NumEl = cast<VectorType>(Ty)->getNumElements();
 					if (NumEl == 2) {
@@ -372,9 +624,10 @@ class SwiftTransformer {
 					v = irBuilder.CreateFPExt(v, TyVecDouble, "swift.floatveccast");
 				} else
 				if (VecTy->isPointerTy()) {
-					// assuming pointers are always 64-bit wide and coming in pairs
-					assert(cast<VectorType>(Ty)->getNumElements() == 2 && "we support only <2 x iX*>");
-					v = irBuilder.CreatePtrToInt(v, TyVecInt64, "swift.ptrveccast");
+					// assuming pointers are always 64-bit wide and coming in 2, 4 or 8
+					unsigned NumEl = cast<VectorType>(Ty)->getNumElements();
+					assert((NumEl == 2 || NumEl == 4 || NumEl == 8) && "we support only <2/4/8 x iX*>");
+					v = irBuilder.CreatePtrToInt(v, VectorType::get(Type::getInt64Ty(getGlobalContext()), NumEl), "swift.ptrveccast");
 				}
 				}
 				break;
@@ -413,13 +666,19 @@ class SwiftTransformer {
 			}
 #endif
 
+		CheckKey key(v1, v2);
+
 		v1 = castToSupportedType(irBuilder, v1);
 		v2 = castToSupportedType(irBuilder, v2);
 
-		Type2FunctionMap::iterator it = swiftHelpers->checkers.find(v1->getType());
-		if (it == swiftHelpers->checkers.end())
+		// in signature mode, differences are only folded into the per-thread
+		// signature; Tx runtime verifies it once before committing Tx
+		Type2FunctionMap& checkers = SignatureChecks ? swiftHelpers->accumulators : swiftHelpers->checkers;
+
+		Type2FunctionMap::iterator it = checkers.find(v1->getType());
+		if (it == checkers.end())
 			errs() << "don't know how to handle type " << *(v1->getType()) << "\n";
-		assert (it != swiftHelpers->checkers.end() && "no checker function found for specified type");
+		assert (it != checkers.end() && "no checker function found for specified type");
 
 		// store checks do not need to move v2 (because they do volatile reload),
 		// so for them movev2 = false; but other checks need a swift-move
@@ -441,7 +700,8 @@ class SwiftTransformer {
 		argsVec.push_back(id);
 		ArrayRef<Value*> argsRef(argsVec);
 
-		irBuilder.CreateCall(it->second, argsRef);
+		CallInst* check = irBuilder.CreateCall(it->second, argsRef);
+		checks.push_back(std::make_pair(check, key));
 	}
 
 	Instruction* createMoveCall(IRBuilder<>& irBuilder, Value* v) {
@@ -485,6 +745,11 @@ class SwiftTransformer {
 			if (v->getType()->isDoubleTy() && origType->isX86_FP80Ty())
 					move = cast<Instruction>(irBuilder.CreateFPExt(move, origType, v->getName() + CLONE_SUFFIX));
 
+			// we could have a 256/512-bit vector reinterpreted as i64s, need to cast back
+			if (v->getType()->isVectorTy() && origType->getVectorElementType()->isIntegerTy() &&
+				(origType->getPrimitiveSizeInBits() == 256 || origType->getPrimitiveSizeInBits() == 512)) {
+					move = cast<Instruction>(irBuilder.CreateBitCast(move, origType, v->getName() + CLONE_SUFFIX));
+			} else
 			// we could have a vector of non-64-bit integers, need to cast back
 			if (v->getType()->isVectorTy() && origType->getVectorElementType()->isIntegerTy()) {
 					Type* TyVecInt64  = VectorType::get(Type::getInt64Ty(getGlobalContext()), 2);
@@ -539,7 +804,382 @@ class SwiftTransformer {
 	}
 
 
+	// scalar arithmetic that can be computed on <2 x T> with one
+	// SIMD instruction (no scalarization by codegen for SSE targets)
+	bool isPackable(Instruction* I) {
+		Type* Ty = I->getType();
+		switch (I->getOpcode()) {
+			case Instruction::FAdd:
+			case Instruction::FSub:
+			case Instruction::FMul:
+			case Instruction::FDiv:
+				return Ty->isDoubleTy() || Ty->isFloatTy();
+
+			case Instruction::Shl:
+			case Instruction::LShr:
+				// per-lane variable shifts are not available in SSE
+				if (!isa<Constant>(I->getOperand(1)))
+					return false;
+				// fall through
+			case Instruction::Add:
+			case Instruction::Sub:
+			case Instruction::And:
+			case Instruction::Or:
+			case Instruction::Xor:
+				return Ty->isIntegerTy(32) || Ty->isIntegerTy(64);
+
+			default:
+				return false;
+		}
+	}
+
+	// pack only straight-line chains: either continue a packed chain or
+	// start a new one if the result feeds another packable instruction
+	bool shouldPack(Instruction* I) {
+		if (!isPackable(I))
+			return false;
+
+		// operand without shadow (e.g., in address-only mode) would be
+		// copied into both lanes, so the shadow lane would not be
+		// independent: replicate I as usual scalar instead
+		for (Value* op : I->operands())
+			if (!isa<Constant>(op) && !packed.count(op) && !shadows.getShadow(op, I))
+				return false;
+
+		for (Value* op : I->operands())
+			if (packed.count(op))
+				return true;
+
+		for (User* U : I->users())
+			if (Instruction* UI = dyn_cast<Instruction>(U))
+				if (UI->getParent() == I->getParent() && isPackable(UI))
+					return true;
+		return false;
+	}
+
+	Value* getPackedOperand(IRBuilder<>& irBuilder, Value* v, Instruction* I) {
+		DenseMap<Value*, Value*>::iterator it = packed.find(v);
+		if (it != packed.end())
+			return it->second;
+
+		if (Constant* C = dyn_cast<Constant>(v))
+			return ConstantVector::getSplat(2, C);
+
+		Value* shadow = shadows.getShadow(v, I);
+		assert(shadow && "packed operand must have shadow (see shouldPack)");
+
+		Value* vec = UndefValue::get(VectorType::get(v->getType(), 2));
+		vec = irBuilder.CreateInsertElement(vec, v, irBuilder.getInt32(0), "swift.pack");
+		vec = irBuilder.CreateInsertElement(vec, shadow, irBuilder.getInt32(1), "swift.pack");
+		return vec;
+	}
+
+	// pass packed value through a swift-move: otherwise -O3 sees that only
+	// single lanes are extracted and scalarizes SIMD instruction back into
+	// one scalar op per lane; 64-bit vectors are moved as i64
+	Value* pinPacked(IRBuilder<>& irBuilder, Value* vec) {
+		Type* Ty = vec->getType();
+		Type2FunctionMap::iterator it = swiftHelpers->movers.find(Ty);
+		if (it != swiftHelpers->movers.end())
+			return irBuilder.CreateCall(it->second, vec, "swift.pin");
+
+		assert(Ty->getPrimitiveSizeInBits() == 64 && "no mover function found for packed type");
+		Type* Int64Ty = irBuilder.getInt64Ty();
+		Value* v = irBuilder.CreateBitCast(vec, Int64Ty);
+		v = irBuilder.CreateCall(swiftHelpers->movers[Int64Ty], v, "swift.pin");
+		return irBuilder.CreateBitCast(v, Ty);
+	}
+
+	// replace scalar I by one SIMD instruction computing master and shadow
+	// copies in lanes 0 and 1; checks on I then compare these two lanes
+	void packInst(Instruction* I, IRBuilder<>& irBuilder) {
+		Value* op0 = getPackedOperand(irBuilder, I->getOperand(0), I);
+		Value* op1 = getPackedOperand(irBuilder, I->getOperand(1), I);
+
+		BinaryOperator* binI = BinaryOperator::Create(cast<BinaryOperator>(I)->getOpcode(), op0, op1);
+		binI->copyIRFlags(I);
+		irBuilder.Insert(binI, I->getName() + ".packed" + CLONE_SUFFIX);
+		Value* vecI = pinPacked(irBuilder, binI);
+
+		Value* master = irBuilder.CreateExtractElement(vecI, irBuilder.getInt32(0));
+		Value* shadow = irBuilder.CreateExtractElement(vecI, irBuilder.getInt32(1), I->getName() + CLONE_SUFFIX);
+
+		I->replaceAllUsesWith(master);
+		master->takeName(I);
+
+		// master takes over I in address slice; drop stale entries of I
+		shadows.erase(I);
+		if (addressSlice.erase(I))
+			addressSlice.insert(master);
+		I->eraseFromParent();
+
+		packed[master] = vecI;
+		shadows.add(master, shadow);
+	}
+
+	Value* getAccessedAddress(Instruction* I) {
+		if (LoadInst* load = dyn_cast<LoadInst>(I))
+			return load->getPointerOperand();
+		if (StoreInst* store = dyn_cast<StoreInst>(I))
+			return store->getPointerOperand();
+		if (AtomicCmpXchgInst* cmpxchg = dyn_cast<AtomicCmpXchgInst>(I))
+			return cmpxchg->getPointerOperand();
+		if (AtomicRMWInst* rmw = dyn_cast<AtomicRMWInst>(I))
+			return rmw->getPointerOperand();
+		return nullptr;
+	}
+
+	// reloaded and shadow values of up to 64 bits are folded as i64 diffs;
+	// other types return null and are checked separately
+	Value* createStoreDiff(IRBuilder<>& irBuilder, Value* loaded, Value* shadowval) {
+		Type* Ty = loaded->getType();
+		Type* Int64Ty = irBuilder.getInt64Ty();
+
+		if (Ty->isPointerTy()) {
+			loaded = irBuilder.CreatePtrToInt(loaded, Int64Ty);
+			shadowval = irBuilder.CreatePtrToInt(shadowval, Int64Ty);
+			Ty = Int64Ty;
+		} else if (Ty->isFloatTy() || Ty->isDoubleTy()) {
+			Type* IntTy = irBuilder.getIntNTy(Ty->getPrimitiveSizeInBits());
+			loaded = irBuilder.CreateBitCast(loaded, IntTy);
+			shadowval = irBuilder.CreateBitCast(shadowval, IntTy);
+			Ty = IntTy;
+		}
+
+		if (!Ty->isIntegerTy() || Ty->getIntegerBitWidth() > 64)
+			return nullptr;
+
+		Value* diff = irBuilder.CreateXor(loaded, shadowval);
+		return irBuilder.CreateZExtOrBitCast(diff, Int64Ty);
+	}
+
+	// reload all pending stores before I and compare them in one check
+	void flushStores(Instruction* I) {
+		IRBuilder<> irBuilder(I);
+		Value* diffs = nullptr;
+
+		for (auto it = pendingStores.begin(); it != pendingStores.end(); ++it) {
+			LoadInst *loadedval = irBuilder.CreateLoad(it->shadowptr, true, "swift.loadtocheckstore"); // volatile load
+			loadedval->setAlignment(it->store->getAlignment());
+
+			Value* diff = createStoreDiff(irBuilder, loadedval, it->shadowval);
+			if (!diff) {
+				createCheckerCall(irBuilder, loadedval, it->shadowval, false);
+				continue;
+			}
+			diffs = diffs ? irBuilder.CreateOr(diffs, diff) : diff;
+		}
+		pendingStores.clear();
+
+		if (diffs)
+			createCheckerCall(irBuilder, diffs, irBuilder.getInt64(0), false);
+	}
+
+	// pending stores must be verified before sync points (calls, atomics,
+	// terminators) and before they can be overwritten by another store
+	bool mustFlushStores(Instruction* I) {
+		static const unsigned MAX_PENDING_STORES = 8;
+
+		if (isa<TerminatorInst>(I) || isa<FenceInst>(I) ||
+			isa<AtomicCmpXchgInst>(I) || isa<AtomicRMWInst>(I))
+			return true;
+
+		if (CallInst* call = dyn_cast<CallInst>(I))
+			return !swiftHelpers->isDuplicatedFunc(call->getCalledFunction());
+
+		if (LoadInst* load = dyn_cast<LoadInst>(I))
+			return load->isAtomic();
+
+		if (StoreInst* store = dyn_cast<StoreInst>(I)) {
+			if (store->isAtomic() || pendingStores.size() >= MAX_PENDING_STORES)
+				return true;
+
+			MemoryLocation loc = MemoryLocation::get(store);
+			for (auto it = pendingStores.begin(); it != pendingStores.end(); ++it)
+				if (!AA || !AA->isNoAlias(loc, MemoryLocation::get(it->store)))
+					return true;
+		}
+		return false;
+	}
+
+	// call dual-value clone passing shadow args; its shadow return value
+	// becomes the shadow of the call result, so no checks or moves needed
+	void createDualCall(CallInst* call) {
+		Function* dual = swiftHelpers->dualFuncs[call->getCalledFunction()];
+		IRBuilder<> irBuilder(call);
+
+		std::vector<Value*> args(call->arg_begin(), call->arg_end());
+		for (auto arg = call->arg_begin(); arg != call->arg_end(); ++arg) {
+			Value* shadow = shadows.getShadow(*arg, call);
+			args.push_back(shadow ? shadow : *arg);
+		}
+
+		CallInst* dualCall = irBuilder.CreateCall(dual, args);
+		dualCall->setCallingConv(call->getCallingConv());
+		dualCall->setTailCall(call->isTailCall());
+
+		if (!call->getType()->isVoidTy()) {
+			Value* master = irBuilder.CreateExtractValue(dualCall, ArrayRef<unsigned>(0));
+			Value* shadow = irBuilder.CreateExtractValue(dualCall, ArrayRef<unsigned>(1), call->getName() + CLONE_SUFFIX);
+			call->replaceAllUsesWith(master);
+			master->takeName(call);
+			shadows.add(master, shadow);
+		}
+		deadCalls.push_back(call);
+	}
+
+	// dual-value clone returns {value, shadow value}
+	void createDualReturn(ReturnInst* ret) {
+		Value* v = ret->getReturnValue();
+		if (!v)
+			return;
+
+		IRBuilder<> irBuilder(ret);
+		Value* shadow = shadows.getShadow(v, ret);
+		if (!shadow && !isa<Constant>(v)) {
+			// not replicated (e.g., in address-only mode): return a moved
+			// copy, so that caller does not get the very same register
+			shadow = createMoveCall(irBuilder, v);
+		}
+		if (!shadow) shadow = v;
+
+		Type* RetTy = ret->getParent()->getParent()->getReturnType();
+		Value* agg = UndefValue::get(RetTy);
+		agg = irBuilder.CreateInsertValue(agg, v, ArrayRef<unsigned>(0));
+		agg = irBuilder.CreateInsertValue(agg, shadow, ArrayRef<unsigned>(1));
+		ret->setOperand(0, agg);
+	}
+
+	Value* getShadowOrSelf(Value* v, Instruction* I) {
+		Value* shadow = shadows.getShadow(v, I);
+		return shadow ? shadow : v;
+	}
+
+	// q = n / d is correct iff q*d does not overflow and the remainder
+	// r = n - q*d satisfies |r| < |d| (and has the sign of n, if signed)
+	Value* createDivResidue(IRBuilder<>& irBuilder, BinaryOperator* I, Value* q) {
+		Value* n = getShadowOrSelf(I->getOperand(0), I);
+		Value* d = getShadowOrSelf(I->getOperand(1), I);
+		bool isSigned = I->getOpcode() == Instruction::SDiv;
+
+		Intrinsic::ID mulID = isSigned ? Intrinsic::smul_with_overflow : Intrinsic::umul_with_overflow;
+		Function* mulF = Intrinsic::getDeclaration(swiftHelpers->module, mulID, I->getType());
+		Value* mul = irBuilder.CreateCall(mulF, {q, d});
+		Value* prod = irBuilder.CreateExtractValue(mul, ArrayRef<unsigned>(0));
+		Value* overflow = irBuilder.CreateExtractValue(mul, ArrayRef<unsigned>(1));
+		Value* r = irBuilder.CreateSub(n, prod);
+
+		Value* ok = irBuilder.CreateNot(overflow);
+		if (!isSigned) {
+			ok = irBuilder.CreateAnd(ok, irBuilder.CreateICmpULE(prod, n));
+			return irBuilder.CreateAnd(ok, irBuilder.CreateICmpULT(r, d));
+		}
+
+		// magnitudes compared unsigned, so that -INT_MIN is handled
+		Value* zero = ConstantInt::get(I->getType(), 0);
+		Value* absR = irBuilder.CreateSelect(irBuilder.CreateICmpSLT(r, zero), irBuilder.CreateNeg(r), r);
+		Value* absD = irBuilder.CreateSelect(irBuilder.CreateICmpSLT(d, zero), irBuilder.CreateNeg(d), d);
+		ok = irBuilder.CreateAnd(ok, irBuilder.CreateICmpULT(absR, absD));
+
+		Value* sameSign = irBuilder.CreateICmpSGE(irBuilder.CreateXor(r, n), zero);
+		return irBuilder.CreateAnd(ok, irBuilder.CreateOr(irBuilder.CreateICmpEQ(r, zero), sameSign));
+	}
+
+	// v is correct iff |computed - expected| is within a few ulps of |expected|;
+	// only checked if v, computed and expected are all normal: a subnormal
+	// expected has no relative precision left, and computed may over- or
+	// underflow even if v is correct
+	Value* createFPResidue(IRBuilder<>& irBuilder, Value* v, Value* computed, Value* expected) {
+		Type* Ty = v->getType();
+		double tolerance = Ty->isFloatTy() ? 4.76837158203125e-07 : 8.8817841970012523e-16;   // 4 ulps
+		double minNormal = Ty->isFloatTy() ? 1.1754943508222875e-38 : 2.2250738585072014e-308; // FLT_MIN/DBL_MIN
+
+		Function* fabsF = Intrinsic::getDeclaration(swiftHelpers->module, Intrinsic::fabs, Ty);
+		Value* absExpected = irBuilder.CreateCall(fabsF, expected);
+		Value* err = irBuilder.CreateCall(fabsF, irBuilder.CreateFSub(computed, expected));
+		Value* bound = irBuilder.CreateFMul(absExpected, ConstantFP::get(Ty, tolerance));
+		Value* ok = irBuilder.CreateFCmpULE(err, bound);
+
+		// NaN, infinity, zero or subnormal: not checked
+		for (Value* x : {v, computed, expected}) {
+			Value* absX = x == expected ? absExpected : irBuilder.CreateCall(fabsF, x);
+			ok = irBuilder.CreateOr(ok, irBuilder.CreateFCmpUEQ(absX, ConstantFP::getInfinity(Ty)));
+			ok = irBuilder.CreateOr(ok, irBuilder.CreateFCmpULT(absX, ConstantFP::get(Ty, minNormal)));
+		}
+		return ok;
+	}
+
+	// shadow long-latency operation by a swift-move of its result and
+	// verify the result against shadow operands using fast ALU operations
+	bool createResidueCheck(IRBuilder<>& irBuilder, Instruction* I) {
+		Type* Ty = I->getType();
+		bool isFP = Ty->isFloatTy() || Ty->isDoubleTy();
+		bool isDiv = I->getOpcode() == Instruction::UDiv || I->getOpcode() == Instruction::SDiv;
+
+		CallInst* call = dyn_cast<CallInst>(I);
+		bool isSqrt = call && call->getCalledFunction() && call->getCalledFunction()->getName().startswith("llvm.sqrt.");
+
+		if (!(isDiv && Ty->isIntegerTy()) && !(isFP && (I->getOpcode() == Instruction::FDiv || isSqrt)))
+			return false;
+
+		Instruction* shadow = createMoveCall(irBuilder, I);
+		shadows.add(I, shadow);
+
+		Value* ok = nullptr;
+		if (isDiv) {
+			ok = createDivResidue(irBuilder, cast<BinaryOperator>(I), shadow);
+		} else if (isSqrt) {
+			Value* x = getShadowOrSelf(call->getArgOperand(0), I);
+			ok = createFPResidue(irBuilder, shadow, irBuilder.CreateFMul(shadow, shadow), x);
+		} else {
+			Value* a = getShadowOrSelf(I->getOperand(0), I);
+			Value* b = getShadowOrSelf(I->getOperand(1), I);
+			ok = createFPResidue(irBuilder, shadow, irBuilder.CreateFMul(shadow, b), a);
+		}
+
+		ok = irBuilder.CreateZExt(ok, irBuilder.getInt8Ty(), "swift.residue");
+		createCheckerCall(irBuilder, ok, irBuilder.getInt8(1), false);
+		ResidueChecked++;
+		return true;
+	}
+
 	public:
+	void removeDeadCalls() {
+		for (CallInst* call : deadCalls)
+			call->eraseFromParent();
+		deadCalls.clear();
+	}
+
+	void setAliasAnalysis(AAResults* inAA) {
+		AA = inAA;
+	}
+
+	// restrict replication to the backward slice of all accessed addresses
+	void setAddressOnly(Function& F) {
+		SmallVector<Instruction*, 64> worklist;
+
+		addressOnly = true;
+		for (inst_iterator I = inst_begin(F), E = inst_end(F); I != E; ++I)
+			if (Value* ptr = getAccessedAddress(&*I))
+				if (Instruction* ptrI = dyn_cast<Instruction>(ptr))
+					if (addressSlice.insert(ptrI).second)
+						worklist.push_back(ptrI);
+
+		while (!worklist.empty()) {
+			Instruction* I = worklist.pop_back_val();
+
+			// results of calls are shadowed by swift-moves, no need for args
+			if (CallInst* call = dyn_cast<CallInst>(I))
+				if (!swiftHelpers->isDuplicatedFunc(call->getCalledFunction()))
+					continue;
+
+			for (Value* op : I->operands())
+				if (Instruction* opI = dyn_cast<Instruction>(op))
+					if (addressSlice.insert(opI).second)
+						worklist.push_back(opI);
+		}
+	}
+
 	void shadowInst(Instruction* I) {
 
 		if (I->use_empty())
@@ -551,10 +1191,21 @@ class SwiftTransformer {
 		assert (!I->isTerminator() && "cannot shadow terminator instruction");
 #endif
 
+		if (addressOnly && !addressSlice.count(I))
+			return;
+
 		// add shadow instruction(s) after I
 		BasicBlock::iterator instIt(I);
 		IRBuilder<> irBuilder(instIt->getParent(), ++instIt);
 
+		if (SimdPack && shouldPack(I)) {
+			packInst(I, irBuilder);
+			return;
+		}
+
+		if (ResidueChecks && createResidueCheck(irBuilder, I))
+			return;
+
 		switch (I->getOpcode()) {
 		/* Standard binary operators */
 		case Instruction::Add:
@@ -699,6 +1350,23 @@ class SwiftTransformer {
 	void checkInst(Instruction* I) {
 		BasicBlock::iterator instIt(I);
 
+		if (addressOnly) {
+			// check only the address right before memory access
+			Value* ptr = getAccessedAddress(I);
+			if (!ptr)
+				return;
+
+			Value* shadowptr = shadows.getShadow(ptr, I);
+			if (shadowptr) {
+				IRBuilder<> irBuilder(instIt->getParent(), instIt);
+				createCheckerCall(irBuilder, ptr, shadowptr, false);
+			}
+			return;
+		}
+
+		if (!pendingStores.empty() && mustFlushStores(I))
+			flushStores(I);
+
 		switch (I->getOpcode()) {
 			case Instruction::AtomicCmpXchg:	// we treat cmpxchg as a load-store instruction
 			case Instruction::AtomicRMW:        // we treat atomicrmw as a load-store instruction
@@ -713,8 +1381,19 @@ class SwiftTransformer {
 					// do not check calls to "ignored" functions
 					if (swiftHelpers->isIgnoredFunc(call->getCalledFunction()))
 					 	break;
+					// internal functions receive shadows instead of checks
+					if (swiftHelpers->dualFuncs.count(call->getCalledFunction())) {
+						createDualCall(call);
+						break;
+					}
 				}
 
+				if (ReturnInst* ret = dyn_cast<ReturnInst>(I))
+					if (swiftHelpers->dualClones.count(ret->getParent()->getParent())) {
+						createDualReturn(ret);
+						break;
+					}
+
 				// add check instruction(s) before I
 				IRBuilder<> irBuilder(instIt->getParent(), instIt);
 				checkInstOperands(I, irBuilder);
@@ -773,6 +1452,14 @@ class SwiftTransformer {
 					break;
 				}
 
+				if (StoreChecks == STORE_CHECK_REGISTER) {
+					// compare stored value and address with their shadows
+					// in registers, no reload from memory
+					IRBuilder<> irBuilder(instIt->getParent(), instIt);
+					checkInstOperands(I, irBuilder);
+					break;
+				}
+
 				// add check instruction(s) after I
 				IRBuilder<> irBuilder(instIt->getParent(), std::next(instIt));
 
@@ -789,6 +1476,13 @@ class SwiftTransformer {
 				Value *shadowptr = shadows.getShadow(ptr, SI);
 				if (!shadowptr)	shadowptr = ptr;
 
+				if (StoreChecks == STORE_CHECK_BATCHED) {
+					// reload and check later, together with other stores
+					PendingStore pending = { SI, shadowptr, shadowval };
+					pendingStores.push_back(pending);
+					break;
+				}
+
 				// alignment
 				unsigned align = SI->getAlignment();
 
@@ -812,6 +1506,16 @@ class SwiftTransformer {
 	}
 
 	void shadowArgs(Function& F, Instruction* firstI) {
+		if (swiftHelpers->dualClones.count(&F)) {
+			// second half of dual-value clone's args are shadows of first half
+			unsigned n = F.arg_size() / 2;
+			auto shadowArg = F.arg_begin();
+			std::advance(shadowArg, n);
+			for (auto arg = F.arg_begin(); n > 0; ++arg, ++shadowArg, --n)
+				shadows.add(&*arg, &*shadowArg);
+			return;
+		}
+
 		// add shadow args' definitions before firstI
 		BasicBlock::iterator instIt(firstI);
 		IRBuilder<> irBuilder(instIt->getParent(), instIt);
@@ -885,43 +1589,52 @@ class SwiftTransformer {
 		}
 	}
 
-	// detect if V already requires check inside loop L:
-	// transitively follow all uses of V that are still inside loop L
-	// and if at least one of these uses requires a check, return true
-	bool requiresCheckTransitive(Loop* L, Value* V) {
-//		errs() << "requiresCheckTransitive: Loop " << L << " Value " << *V << "\n";
-		for (User *U : V->users()) {
-			if (!isa<Instruction>(U))
-				continue;
-			Instruction* I = cast<Instruction>(U);
-
-			if (!L->contains(I))
-				continue;
+	// instruction inside loop that makes all its operands checked
+	bool isCheckingInst(Instruction* I) {
+		if (isa<StoreInst>(I) || isa<BranchInst>(I) ||
+			isa<AtomicCmpXchgInst>(I) || isa<AtomicRMWInst>(I) ||
+			isa<ReturnInst>(I) || isa<SwitchInst>(I) || isa<InvokeInst>(I))
+			return true;
 
-			if (isa<PHINode>(I) && I->getParent() == L->getHeader()) {
-				// to break cycle dep, stop on the loop header's phi nodes
-				continue;
-			}
+		if (LoadInst* load = dyn_cast<LoadInst>(I))
+			if (load->isAtomic())
+				return true;
 
-			if (isa<StoreInst>(I) || isa<BranchInst>(I) ||
-				isa<AtomicCmpXchgInst>(I) || isa<AtomicRMWInst>(I) ||
-				isa<ReturnInst>(I) || isa<SwitchInst>(I) || isa<InvokeInst>(I))
+		if (CallInst* call = dyn_cast<CallInst>(I)) {
+			if (!swiftHelpers->isDuplicatedFunc(call->getCalledFunction()) &&
+				!swiftHelpers->isIgnoredFunc(call->getCalledFunction()))
 				return true;
+		}
+		return false;
+	}
 
-			if (LoadInst* load = dyn_cast<LoadInst>(I))
-				if (load->isAtomic())
-					return true;
+	// single dataflow pass over loop L: collect all values whose def-use
+	// chains inside L reach an instruction that requires a check; walks
+	// backwards from such instructions over operands and stops on the loop
+	// header's phi nodes to break cycle deps (each value is visited once)
+	void collectCheckedValues(Loop* L, DenseSet<Value*>& checked) {
+		BasicBlock* header = L->getHeader();
+		SmallVector<Instruction*, 32> worklist;
 
-			if (CallInst* call = dyn_cast<CallInst>(I)) {
-				if (!swiftHelpers->isDuplicatedFunc(call->getCalledFunction()) &&
-					!swiftHelpers->isIgnoredFunc(call->getCalledFunction()))
-			 	return true;
-			}
+		for (BasicBlock* BB : L->blocks())
+			for (Instruction& I : *BB)
+				if (isCheckingInst(&I))
+					worklist.push_back(&I);
 
-			if (requiresCheckTransitive(L, I))
-				return true;
+		while (!worklist.empty()) {
+			Instruction* I = worklist.pop_back_val();
+			for (Value* op : I->operands()) {
+				if (!checked.insert(op).second)
+					continue;
+
+				Instruction* opI = dyn_cast<Instruction>(op);
+				if (!opI || !L->contains(opI))
+					continue;
+				if (isa<PHINode>(opI) && opI->getParent() == header)
+					continue;
+				worklist.push_back(opI);
+			}
 		}
-		return false;
 	}
 
 	void insertChecksOnLoopHeader(Loop* L, DominatorTree* DT) {
@@ -934,7 +1647,11 @@ class SwiftTransformer {
 			return;
 		}
 
+		DenseSet<Value*> checked;
+		collectCheckedValues(L, checked);
+
 		std::vector<PHINode*> phiesToCheck;
+		std::vector<PHINode*> inductionsToCheck;
 		BasicBlock* header = L->getHeader();
 		for (BasicBlock::iterator I = header->begin(); I != header->end(); I++) {
 			if (!isa<PHINode>(I)) {
@@ -952,8 +1669,31 @@ class SwiftTransformer {
 			// if it is used in some loop instr that requires a check, then
 			// this phi is assumed to be already checked inside the loop,
 			// if there are no such instrs, this phi must be explicitly checked
-			if (!requiresCheckTransitive(L, phi))
-				phiesToCheck.push_back(phi);
+			if (checked.count(phi))
+				continue;
+
+#ifdef SWIFT_OPTIMIZE_LOOP_CHECKS
+			// induction variable is checked once on each loop exit instead:
+			// any fault in its recurrence propagates until there
+			if (getInductionPhi(L, phi) == phi) {
+				inductionsToCheck.push_back(phi);
+				continue;
+			}
+#endif
+			phiesToCheck.push_back(phi);
+		}
+
+		if (!inductionsToCheck.empty()) {
+			// dedicated exits are dominated by loop header, so phi is available;
+			// collect exits before header is split below (LI is not updated)
+			SmallVector<BasicBlock*, 4> exits;
+			L->getUniqueExitBlocks(exits);
+			for (BasicBlock* exit : exits) {
+				IRBuilder<> irBuilder(&*exit->getFirstInsertionPt());
+				for (PHINode* phi : inductionsToCheck)
+					createCheckerCall(irBuilder, phi, shadows.getShadow(phi, phi), false);
+			}
+			InductionChecksSunk += inductionsToCheck.size();
 		}
 
 		if (!phiesToCheck.empty()) {
@@ -1048,6 +1788,120 @@ class SwiftTransformer {
 
 	}
 
+	void eraseCheck(CallInst* check) {
+		SmallVector<Value*, 3> ops(check->arg_begin(), check->arg_end());
+		check->eraseFromParent();
+
+		// remove now-unused casts feeding the check
+		for (Value* op : ops)
+			RecursivelyDeleteTriviallyDeadInstructions(op);
+	}
+
+	// header phi of a simple induction variable (phi = phi +/- const on
+	// the latch) if v is this phi or its increment, otherwise null
+	PHINode* getInductionPhi(Loop* L, Value* v) {
+		BasicBlock* latch = L->getLoopLatch();
+		if (!latch || !L->hasDedicatedExits())
+			return nullptr;
+
+		PHINode* phi = dyn_cast<PHINode>(v);
+		if (!phi) {
+			BinaryOperator* inc = dyn_cast<BinaryOperator>(v);
+			if (!inc)
+				return nullptr;
+			phi = dyn_cast<PHINode>(inc->getOperand(0));
+		}
+		if (!phi || phi->getParent() != L->getHeader() || phi->getNumIncomingValues() != 2)
+			return nullptr;
+
+		BinaryOperator* inc = dyn_cast<BinaryOperator>(phi->getIncomingValueForBlock(latch));
+		if (!inc || inc->getOperand(0) != phi || !isa<ConstantInt>(inc->getOperand(1)))
+			return nullptr;
+		if (inc->getOpcode() != Instruction::Add && inc->getOpcode() != Instruction::Sub)
+			return nullptr;
+
+		if (v != phi && v != inc)
+			return nullptr;
+		return shadows.hasShadow(phi) ? phi : nullptr;
+	}
+
+	// check was created with a swift-move on its shadow operand
+	bool isMovedCheck(CallInst* check) {
+		CallInst* move = dyn_cast<CallInst>(check->getArgOperand(1));
+		return move && move->getCalledFunction() &&
+			swiftHelpers->helpers.count(move->getCalledFunction()) &&
+			move->getCalledFunction()->getName().count("move");
+	}
+
+	void optimizeLoopChecks(LoopInfo& LI) {
+		std::set<std::pair<BasicBlock*, CheckKey> > hoisted;
+
+		// new checks are recorded in "checks" again
+		std::vector<std::pair<CallInst*, CheckKey> > loopChecks;
+		loopChecks.swap(checks);
+
+		for (auto it = loopChecks.begin(); it != loopChecks.end(); ++it) {
+			CallInst* check = it->first;
+			CheckKey key = it->second;
+
+			Loop* L = LI.getLoopFor(check->getParent());
+			if (!L) {
+				checks.push_back(*it);
+				continue;
+			}
+
+			// find outermost loop in which both values are invariant
+			Loop* target = nullptr;
+			for (Loop* cur = L; cur && cur->getLoopPreheader() &&
+					cur->isLoopInvariant(key.first) && cur->isLoopInvariant(key.second);
+					cur = cur->getParentLoop())
+				target = cur;
+
+			if (!target) {
+				checks.push_back(*it);
+				continue;
+			}
+
+			BasicBlock* preheader = target->getLoopPreheader();
+			if (hoisted.insert(std::make_pair(preheader, key)).second) {
+				IRBuilder<> irBuilder(preheader->getTerminator());
+				createCheckerCall(irBuilder, key.first, key.second, isMovedCheck(check));
+			}
+			eraseCheck(check);
+			ChecksHoisted++;
+		}
+	}
+
+	void removeDominatedChecks(DominatorTree& DT) {
+		// group checks by the master/shadow pair they compare
+		DenseMap<CheckKey, SmallVector<CallInst*, 4> > groups;
+		for (auto it = checks.begin(); it != checks.end(); ++it)
+			groups[it->second].push_back(it->first);
+
+		std::vector<CallInst*> redundant;
+		for (auto git = groups.begin(); git != groups.end(); ++git) {
+			SmallVector<CallInst*, 4>& group = git->second;
+			if (group.size() < 2)
+				continue;
+
+			// SSA values are never redefined, so a check dominated by an
+			// identical one cannot detect anything new; dominance is
+			// transitive, so the topmost check of each chain survives
+			for (CallInst* check : group)
+				for (CallInst* other : group)
+					if (other != check && DT.dominates(other, check)) {
+						redundant.push_back(check);
+						break;
+					}
+		}
+
+		for (CallInst* check : redundant) {
+			eraseCheck(check);
+			ChecksEliminated++;
+		}
+		checks.clear();
+	}
+
 	SwiftTransformer(SwiftHelpers* inSwiftHelpers) {
 		swiftHelpers = inSwiftHelpers;
 	}
@@ -1055,14 +1909,75 @@ class SwiftTransformer {
 
 class SwiftPass : public FunctionPass {
 	SwiftHelpers* swiftHelpers;
+	HardeningPlan* plan;
 
 	public:
 	static char ID; // Pass identification, replacement for typeid
 
 	SwiftPass(): FunctionPass(ID) { }
 
+	bool isDualCandidate(Function* F) {
+		if (F->isDeclaration() || !F->hasLocalLinkage() || F->isVarArg() || F->hasAddressTaken())
+			return false;
+		if (swiftHelpers->isIgnoredFunc(F) || plan->getLevel(F) != HARDEN_FULL)
+			return false;
+
+		// callee must not write through shadow pointer args
+		AttributeSet attrs = F->getAttributes();
+		if (attrs.hasAttrSomewhere(Attribute::ByVal) || attrs.hasAttrSomewhere(Attribute::InAlloca) ||
+			attrs.hasAttrSomewhere(Attribute::StructRet))
+			return false;
+
+		return !F->getReturnType()->isStructTy();
+	}
+
+	// clone internal functions F(args) into F.swift(args, shadow args) that
+	// return {value, shadow value}; calls are redirected during hardening
+	void createDualFunctions(Module& M) {
+		std::vector<Function*> candidates;
+		for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F)
+			if (isDualCandidate(&*F))
+				candidates.push_back(&*F);
+
+		for (Function* F : candidates) {
+			std::vector<Type*> params;
+			for (unsigned i = 0; i < 2; ++i)
+				for (auto arg = F->arg_begin(); arg != F->arg_end(); ++arg)
+					params.push_back(arg->getType());
+
+			Type* RetTy = F->getReturnType();
+			if (!RetTy->isVoidTy())
+				RetTy = StructType::get(M.getContext(), {RetTy, RetTy});
+
+			FunctionType* FT = FunctionType::get(RetTy, params, false);
+			Function* NF = Function::Create(FT, F->getLinkage(), F->getName() + CLONE_SUFFIX, &M);
+
+			ValueToValueMapTy VMap;
+			auto newArg = NF->arg_begin();
+			for (auto arg = F->arg_begin(); arg != F->arg_end(); ++arg, ++newArg) {
+				newArg->setName(arg->getName());
+				VMap[&*arg] = &*newArg;
+			}
+			for (auto arg = F->arg_begin(); arg != F->arg_end(); ++arg, ++newArg)
+				newArg->setName(arg->getName() + CLONE_SUFFIX);
+
+			SmallVector<ReturnInst*, 8> returns;
+			CloneFunctionInto(NF, F, VMap, false, returns);
+
+			// attributes of T are not valid for {T, T}
+			AttributeSet newAttrs = NF->getAttributes();
+			NF->setAttributes(newAttrs.removeAttributes(M.getContext(), AttributeSet::ReturnIndex, newAttrs.getRetAttributes()));
+
+			swiftHelpers->dualFuncs[F] = NF;
+			swiftHelpers->dualClones.insert(NF);
+		}
+	}
+
 	virtual bool doInitialization(Module& M) {
 		swiftHelpers = new SwiftHelpers(M);
+		plan = new HardeningPlan(M, swiftHelpers);
+		if (DualCalls)
+			createDualFunctions(M);
 		return true;
 	}
 
@@ -1071,9 +1986,16 @@ class SwiftPass : public FunctionPass {
 
 		if (swiftHelpers->isIgnoredFunc(&F)) return false;
 
+		HardeningLevel level = plan->getLevel(&F);
+		if (level == HARDEN_NONE) return false;
+
 		DominatorTree& DT = getAnalysis<DominatorTreeWrapperPass>().getDomTree();
 		LoopInfo& LI = getAnalysis<LoopInfoWrapperPass>().getLoopInfo();
 		SwiftTransformer swifter(swiftHelpers);
+		if (level == HARDEN_ADDRESS)
+			swifter.setAddressOnly(F);
+		if (StoreChecks == STORE_CHECK_BATCHED)
+			swifter.setAliasAnalysis(&getAnalysis<AAResultsWrapperPass>().getAAResults());
 
 		bool shadowedArgs = false;
 
@@ -1113,9 +2035,21 @@ class SwiftPass : public FunctionPass {
 			}
 		}
 
+		swifter.removeDeadCalls();
 		swifter.rewireShadowPhis();
-		swifter.insertChecksOnLoopHeaders(LI, &DT);
-		swifter.addControlFlowChecks();
+#ifdef SWIFT_OPTIMIZE_LOOP_CHECKS
+		swifter.optimizeLoopChecks(LI);
+#endif
+		if (level == HARDEN_FULL) {
+			swifter.insertChecksOnLoopHeaders(LI, &DT);
+			swifter.addControlFlowChecks();
+		}
+
+#ifdef SWIFT_OPTIMIZE_DOMINATED_CHECKS
+		// control flow checks could have split BBs, recompute dominators
+		DT.recalculate(F);
+		swifter.removeDominatedChecks(DT);
+#endif
 
 		// some swift-moves can become redundant due to checks optimized away
 		// -> find and remove them
@@ -1149,6 +2083,7 @@ class SwiftPass : public FunctionPass {
 	}
 
 	virtual bool doFinalization(Module& M) {
+		delete plan;
 		delete swiftHelpers;
 		return false;
 	}
@@ -1157,6 +2092,7 @@ class SwiftPass : public FunctionPass {
 		UA.addRequired<LoopInfoWrapperPass>();
 		UA.addPreserved<LoopInfoWrapperPass>();
 		UA.addRequired<DominatorTreeWrapperPass>();
+		UA.addRequired<AAResultsWrapperPass>();
 		FunctionPass::getAnalysisUsage(UA);
 	}
 };
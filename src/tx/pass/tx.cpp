@@ -30,9 +30,11 @@
 // do not result in aborts.
 #define TRANS_OPTIMIZE_TIGHTLOOPS
 
-// Erase transaction ends and starts around pthread_mutex_lock/unlock
-// if critical section guarded by them is "tiny" (spans 1-2 BBs and
-// has no calls to other functions).
+// Erase transaction ends and starts around lock/unlock (pthread mutex,
+// spinlock and C++ std::mutex) if critical section guarded by them
+// is "tiny" (spans few BBs and has no calls to other functions).
+// rwlocks are not elided (readers would conflict on the lock word inside
+// Tx), their calls stay ordinary Tx boundaries.
 // This optimization substitutes tiny critical sections that produce
 // huge overhead due to Tx-end & Tx-start by optimistic HTM.
 #define TRANS_OPTIMIZE_CRITICALSECTIONS
@@ -41,6 +43,14 @@
 // NOTE: assumes an earlier Swift pass, does not alter behaviour w/o it
 #define TRANS_INSERT_CHECKS_ON_LOOP_HEADERS
 
+// Strip-mine innermost counted loops (trip count known to ScalarEvolution):
+// instead of incrementing the dynamic counter and checking runtime
+// thresholds every iteration, a local chunk counter does so once every K
+// iterations, with K chosen statically so that a chunk stays within
+// -tx-loop-budget; whether Tx restarts is still decided by the runtime.
+// Loops that fit into the budget entirely get no Tx boundaries at all.
+#define TRANS_STRIPMINE_LOOPS
+
 
 #include <llvm/Pass.h>
 #include <llvm/Support/raw_ostream.h>
@@ -56,11 +66,25 @@
 #include <llvm/IR/DerivedTypes.h>
 #include <llvm/IR/Module.h>
 #include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/IR/DataLayout.h>
+#include <llvm/IR/Dominators.h>
 #include <llvm/Support/Casting.h>
 #include <llvm/Analysis/LoopInfo.h>
 #include <llvm/Analysis/LoopIterator.h>
+#include <llvm/Analysis/ScalarEvolution.h>
+#include <llvm/Analysis/CallGraph.h>
+#include <llvm/Analysis/CFG.h>
+#include <llvm/Analysis/ValueTracking.h>
+#include <llvm/ADT/SCCIterator.h>
+#include <llvm/ADT/PostOrderIterator.h>
+#include <llvm/IR/MDBuilder.h>
+#include <llvm/Transforms/Utils/BasicBlockUtils.h>
 #include <llvm/Support/CommandLine.h>
+#include <llvm/Support/ErrorHandling.h>
 
+#include <algorithm>
+#include <fstream>
 #include <map>
 #include <set>
 
@@ -75,12 +99,64 @@ static cl::list<std::string>
 	CalledFromOutside("called-from-outside", cl::ZeroOrMore,
 	cl::desc("Function (typically event handler) that is called from outside"));
 
+static cl::opt<bool>
+	InferCalledFromOutside("infer-called-from-outside", cl::Optional, cl::init(false),
+	cl::desc("Infer funcs called from outside: callbacks passed to outside funcs (pthread_create, qsort, ...) and escaping func pointers"));
+
+static cl::opt<bool>
+	InferExternallyVisible("infer-externally-visible", cl::Optional, cl::init(false),
+	cl::desc("Treat all externally visible funcs as called from outside (for libraries)"));
+
 static cl::opt<bool>
 	FuncPointersKnown("func-pointers-known", cl::Optional, cl::init(false),
 	cl::desc("All func pointers point only to known (defined in module) funcs"));
 
+static cl::opt<bool>
+	UndoLog("tx-undo-log", cl::Optional, cl::init(false),
+	cl::desc("Log old memory contents before stores (for software Tx runtime tx_stm.c)"));
+
+static cl::opt<std::string>
+	SafeFuncsFile("tx-safe-funcs", cl::Optional, cl::init(""),
+	cl::desc("File with outside funcs that may be called inside Tx (one per line)"));
+
+static cl::opt<std::string>
+	UnsafeFuncsFile("tx-unsafe-funcs", cl::Optional, cl::init(""),
+	cl::desc("File with outside funcs that must never be called inside Tx (one per line)"));
+
+static cl::opt<unsigned>
+	ExternalCallCost("tx-external-call-cost", cl::Optional, cl::init(20),
+	cl::desc("Estimated cost of call to tx-safe outside func (e.g., libm)"));
+
+static cl::opt<unsigned>
+	InlineCostLimit("tx-inline-cost-limit", cl::Optional, cl::init(50),
+	cl::desc("Max cost of local leaf function accounted statically at call sites (0 to disable)"));
+
+static cl::opt<unsigned>
+	WriteWeight("tx-write-weight", cl::Optional, cl::init(8),
+	cl::desc("Weight of written cache line relative to read one in Tx footprint"));
+
+static cl::opt<unsigned>
+	LoopFootprintBudget("tx-loop-footprint", cl::Optional, cl::init(256),
+	cl::desc("Max weighted cache lines per chunk of strip-mined loop"));
+
+static cl::opt<unsigned>
+	CriticalSectionBlocks("tx-cs-max-blocks", cl::Optional, cl::init(8),
+	cl::desc("Max BBs of critical section to elide its lock"));
+
+static cl::opt<unsigned>
+	LoopBudget("tx-loop-budget", cl::Optional, cl::init(400),
+	cl::desc("Max instructions per chunk of strip-mined loop, Tx counters are checked once per chunk"));
+
 STATISTIC(TransNum, "Number of transactions inserted");
 STATISTIC(CondTransNum, "Number of conditional transactions inserted");
+STATISTIC(LoopsStripMined, "Number of loops strip-mined into Tx chunks");
+STATISTIC(LoopsInOneTx, "Number of counted loops that fit into one Tx");
+STATISTIC(InferredOutsideFuncs, "Number of funcs inferred as called from outside");
+STATISTIC(FixedCostFuncs, "Number of functions with static cost summary (no Tx boundaries)");
+STATISTIC(FixedCostCalls, "Number of calls accounted statically at call site");
+STATISTIC(TxSafeCalls, "Number of calls to outside funcs kept inside Tx");
+STATISTIC(CriticalSectionsElided, "Number of lock/unlock calls without Tx boundaries");
+STATISTIC(UndoLogNum, "Number of stores instrumented with undo log");
 
 namespace {
 
@@ -93,6 +169,56 @@ Function *tx_threshold_exceeded_func   = nullptr;
 Function *tx_increment_func            = nullptr;
 Function *tx_pthread_mutex_lock_func   = nullptr;
 Function *tx_pthread_mutex_unlock_func = nullptr;
+Function *tx_pthread_spin_lock_func    = nullptr;
+Function *tx_pthread_spin_unlock_func  = nullptr;
+Function *tx_undo_log_func             = nullptr;
+Function *tx_return_func               = nullptr;
+
+// lock/unlock funcs that start/end critical sections and their Tx wrappers
+enum LockKind {LOCK_MUTEX, LOCK_SPIN};
+
+struct LockFunc {
+	LockKind kind;
+	bool isLock;          // lock or unlock?
+	Function** wrapper;   // Tx wrapper substituting func in critical section
+};
+
+bool getLockFunc(Function* F, LockFunc& info) {
+	static std::map<std::string, LockFunc> lock_funcs {
+		{"pthread_mutex_lock",    {LOCK_MUTEX,  true,  &tx_pthread_mutex_lock_func}},
+		{"pthread_mutex_unlock",  {LOCK_MUTEX,  false, &tx_pthread_mutex_unlock_func}},
+		{"pthread_spin_lock",     {LOCK_SPIN,   true,  &tx_pthread_spin_lock_func}},
+		{"pthread_spin_unlock",   {LOCK_SPIN,   false, &tx_pthread_spin_unlock_func}},
+		// C++ std::mutex (libstdc++), wraps pthread mutex
+		{"_ZNSt5mutex4lockEv",    {LOCK_MUTEX,  true,  &tx_pthread_mutex_lock_func}},
+		{"_ZNSt5mutex6unlockEv",  {LOCK_MUTEX,  false, &tx_pthread_mutex_unlock_func}},
+	};
+
+	if (!F || !F->hasName())
+		return false;
+	std::string FuncName = F->getName().str();
+	auto it = lock_funcs.find(FuncName);
+	if (it != lock_funcs.end()) {
+		info = it->second;
+		return true;
+	}
+	// libstdc++ __gthread wrappers are static, so names are mangled locally
+	if (FuncName.find("__gthread_mutex_lock") != std::string::npos) {
+		info = lock_funcs["pthread_mutex_lock"];
+		return true;
+	}
+	if (FuncName.find("__gthread_mutex_unlock") != std::string::npos) {
+		info = lock_funcs["pthread_mutex_unlock"];
+		return true;
+	}
+	return false;
+}
+
+// funcs called from outside found by inferCalledFromOutside()
+std::set<std::string> InferredFromOutside;
+
+// unique id of each Tx start site, runtime keeps per-site Tx thresholds
+unsigned tx_next_site = 0;
 
 bool isSwiftFunc(std::string FuncName) {
 	std::string prefix = "SWIFT$";
@@ -111,26 +237,108 @@ bool isInternalFunc(Function* F) {
 			F == tx_threshold_exceeded_func ||
 			F == tx_increment_func ||
 			F == tx_pthread_mutex_lock_func ||
-			F == tx_pthread_mutex_unlock_func)
+			F == tx_pthread_mutex_unlock_func ||
+			F == tx_pthread_spin_lock_func ||
+			F == tx_pthread_spin_unlock_func ||
+			F == tx_undo_log_func ||
+			F == tx_return_func)
 			return true;
 
 		if (F->getName() != "" && isSwiftFunc(F->getName()))
 			return true;
+
+		// other non-inlined functions of Tx runtime must not be transactified
+		static std::set<std::string> runtime_funcs {
+			"tx_stats_dump",
+			"haft_get_stats",
+			"tx_stm_stack_low",
+			"tx_stm_rollback",
+			"tx_output_flush",
+			"tx_write",
+			"tx_config_init",
+			"tx_config_read_file",
+			"tx_config_set",
+			"tx_config_knob"
+		};
+		if (runtime_funcs.count(F->getName().str()))
+			return true;
 	}
 	return false;
 }
 
 // helper functions
-bool isCallToOutside(Function* F) {
-	static std::set<std::string> func_exceptions {
-		// math funcs must be simple and no syscalls
-		"__log_finite",
-		// rands are simple and no syscalls
-		"rand",
-		"lrand48",
-		"__dummy__"
-	};
+// outside funcs known to be simple and without syscalls (safe inside Tx)
+std::set<std::string> TxSafeLibFuncs {
+	// math funcs must be simple and no syscalls
+	"__log_finite", "__exp_finite", "__pow_finite", "__sqrt_finite",
+	"__acos_finite", "__asin_finite", "__atan2_finite", "__log10_finite",
+	"sqrt", "sqrtf", "cbrt", "cbrtf", "exp", "expf", "exp2", "exp2f",
+	"log", "logf", "log2", "log2f", "log10", "log10f", "pow", "powf",
+	"sin", "sinf", "cos", "cosf", "tan", "tanf", "asin", "asinf",
+	"acos", "acosf", "atan", "atanf", "atan2", "atan2f",
+	"sinh", "sinhf", "cosh", "coshf", "tanh", "tanhf", "erf", "erff",
+	"fabs", "fabsf", "floor", "floorf", "ceil", "ceilf", "round", "roundf",
+	"trunc", "truncf", "fmod", "fmodf", "fmin", "fminf", "fmax", "fmaxf",
+	"abs", "labs", "llabs",
+	// formatting of my_printf & co. (benches/util/libc), which defer output
+	// via tx_write: HTM rolls back their stores, and rare syscalls (e.g.,
+	// loading locale data) merely abort Tx; safe only because this list is
+	// skipped under -tx-undo-log
+	"vsnprintf", "snprintf", "strerror",
+	// string funcs only read memory
+	"strlen", "strnlen", "strcmp", "strncmp", "memcmp", "strchr", "strrchr",
+	// rands are simple and no syscalls
+	"rand",
+	"lrand48",
+	"__dummy__"
+};
+
+// user-supplied lists of outside funcs (-tx-safe-funcs / -tx-unsafe-funcs)
+std::set<std::string> TxSafeFuncs;
+std::set<std::string> TxUnsafeFuncs;
 
+// can call to outside func F stay inside current Tx?
+bool isTxSafeFunc(Function* F) {
+	if (!F || !F->isDeclaration() || isInternalFunc(F))
+		return false;
+	std::string FuncName = F->getName().str();
+	// denylist takes precedence over everything else
+	if (TxUnsafeFuncs.count(FuncName))
+		return false;
+	if (TxSafeFuncs.count(FuncName))
+		return true;
+	// built-in list assumes HTM: under undo log, writes of libm to errno
+	// would not be rolled back
+	if (!UndoLog && TxSafeLibFuncs.count(FuncName))
+		return true;
+	// no side effects on memory and no unwinding implies no syscalls
+	if (F->doesNotAccessMemory())
+		return true;
+	if (F->onlyReadsMemory() && F->doesNotThrow())
+		return true;
+	return false;
+}
+
+void loadFuncList(const std::string& FileName, std::set<std::string>& Funcs) {
+	if (FileName.empty())
+		return;
+	std::ifstream file(FileName);
+	if (!file)
+		report_fatal_error(Twine("Tx: cannot open list of funcs ") + FileName);
+
+	// one func name per line, '#' starts a comment
+	std::string line;
+	while (std::getline(file, line)) {
+		line = line.substr(0, line.find('#'));
+		size_t first = line.find_first_not_of(" \t\r");
+		if (first == std::string::npos)
+			continue;
+		size_t last = line.find_last_not_of(" \t\r");
+		Funcs.insert(line.substr(first, last - first + 1));
+	}
+}
+
+bool isCallToOutside(Function* F) {
 	// if user specified to be very conservative
 	if (FuncExplicitTrans)
 		return true;
@@ -142,8 +350,8 @@ bool isCallToOutside(Function* F) {
 	// function is internal function like Trans/Swift funcs or LLVM intrinsics
 	if (isInternalFunc(F))
 		return false;
-	// function is an outside function, but exception
-	if (func_exceptions.count(F->getName()))
+	// function is an outside function, but safe inside Tx
+	if (isTxSafeFunc(F))
 		return false;
 	// function is an outside function (no definition of F in this module)
 	if (F->isDeclaration())
@@ -162,22 +370,253 @@ bool isCalledFromOutside(std::string FuncName) {
 	// check user-specified list of funcs
 	if (std::find(CalledFromOutside.begin(), CalledFromOutside.end(), FuncName) != CalledFromOutside.end())
 		return true;
+	// check automatically inferred funcs
+	if (InferredFromOutside.count(FuncName))
+		return true;
 	return false;
 }
 
+// does address of F (or its cast V) escape to code that may call F from outside?
+bool isAddressEscaping(Value* V, Function* F) {
+	for (auto ui = V->user_begin(), ue = V->user_end(); ui != ue; ++ui) {
+		User* U = *ui;
+		if (isa<ConstantExpr>(U) && cast<ConstantExpr>(U)->isCast()) {
+			if (isAddressEscaping(U, F))
+				return true;
+			continue;
+		}
+
+		if (isa<CallInst>(U) || isa<InvokeInst>(U)) {
+			Value* calledValue = nullptr;
+			Function* callee = nullptr;
+			if (CallInst* call = dyn_cast<CallInst>(U)) {
+				calledValue = call->getCalledValue();
+				callee = call->getCalledFunction();
+			} else {
+				calledValue = cast<InvokeInst>(U)->getCalledValue();
+				callee = cast<InvokeInst>(U)->getCalledFunction();
+			}
+			// direct call of F (and F is not its argument), not an escape
+			if (calledValue == V && U->getNumOperands() > 0 &&
+					std::count(U->op_begin(), U->op_end(), V) == 1)
+				continue;
+
+			// callback passed to outside func, e.g., pthread_create, qsort,
+			// signal, atexit; this is the most common case of entry points
+			if (!callee || (callee->isDeclaration() && !isInternalFunc(callee)))
+				return true;
+			// passed to local func, which may call it indirectly
+			if (!FuncPointersKnown)
+				return true;
+			continue;
+		}
+
+		// stored into memory or global initializer (e.g., table of handlers):
+		// indirect calls through it are treated as calls to outside
+		if (!FuncPointersKnown)
+			return true;
+	}
+	return false;
+}
+
+void inferCalledFromOutside(Module& M) {
+	InferredFromOutside.clear();
+	if (!InferCalledFromOutside)
+		return;
+
+	for (Module::iterator fi = M.begin(), fe = M.end(); fi != fe; ++fi) {
+		Function* F = &*fi;
+		if (F->isDeclaration() || isInternalFunc(F) || !F->hasName())
+			continue;
+
+		bool outside = isAddressEscaping(F, F);
+		if (InferExternallyVisible && !F->hasLocalLinkage())
+			outside = true;
+
+		if (outside && !isCalledFromOutside(F->getName())) {
+			InferredFromOutside.insert(F->getName().str());
+			InferredOutsideFuncs++;
+		}
+	}
+}
+
+
+// ----------------------------- Tx footprint -------------------------------- //
+// HTM capacity is limited by cache lines read and written rather than by
+// instructions, so besides instruction count the pass estimates footprint:
+// distinct (base, offset / cache line) pairs accessed in a BB, where written
+// lines weigh WriteWeight (write set is bounded by L1, read set is not).
+const int64_t CACHE_LINE_SHIFT = 6;
+
+typedef std::pair<Value*, int64_t> LineKey;
+
+// footprint added by I, given lines already accessed in BB
+size_t getFootprint(Instruction* I, std::set<LineKey>& Lines) {
+	Value* ptr = nullptr;
+	bool write = false;
+	if (LoadInst* load = dyn_cast<LoadInst>(I)) {
+		ptr = load->getPointerOperand();
+	} else if (StoreInst* store = dyn_cast<StoreInst>(I)) {
+		ptr = store->getPointerOperand();
+		write = true;
+	} else if (AtomicRMWInst* rmw = dyn_cast<AtomicRMWInst>(I)) {
+		ptr = rmw->getPointerOperand();
+		write = true;
+	} else if (AtomicCmpXchgInst* cas = dyn_cast<AtomicCmpXchgInst>(I)) {
+		ptr = cas->getPointerOperand();
+		write = true;
+	} else {
+		return 0;
+	}
+
+	int64_t offset = 0;
+	Value* base = GetPointerBaseWithConstantOffset(ptr, offset, I->getModule()->getDataLayout());
+	// lowest bit of line distinguishes reads and writes
+	LineKey key(base, ((offset >> CACHE_LINE_SHIFT) << 1) | (write ? 1 : 0));
+	if (!Lines.insert(key).second)
+		return 0;
+	return write ? WriteWeight : 1;
+}
+
+// ---------------------- interprocedural cost summaries --------------------- //
+// Local functions that have no loops, no calls to outside or unknown funcs and
+// whose longest path (incl. callees) is below InlineCostLimit have a static
+// cost; they get no Tx boundaries, and their callers simply add this cost to
+// the longest path at call site instead of incrementing the dynamic counter
+// and conditionally starting Tx after the call.
+std::map<Function*, size_t> FixedCosts;
+std::map<Function*, size_t> FixedFootprints;
+
+bool hasFixedCost(Function* F) {
+	return F && FixedCosts.count(F) > 0;
+}
+
+// same counting as Transactifier: no-op casts, phies and unreachables are free
+bool isFreeInst(Instruction* I) {
+	if (CastInst* ci = dyn_cast<CastInst>(I)) {
+		// assuming 64-bit platform
+		static Type* IntPtrTy = Type::getInt64Ty(getGlobalContext());
+		if (ci->isNoopCast(IntPtrTy))
+			return true;
+	}
+	return isa<PHINode>(I) || isa<UnreachableInst>(I);
+}
+
+// returns false if F has no static cost, otherwise its cost in Cost
+// and its footprint in Footprint
+bool computeFixedCost(Function* F, size_t& Cost, size_t& Footprint) {
+	if (F->isDeclaration() || isInternalFunc(F) || isCalledFromOutside(F->getName()))
+		return false;
+
+	// indirect or external callers do not know callee is fixed-cost and
+	// would not account for its increment
+	if (!F->hasLocalLinkage() || F->hasAddressTaken())
+		return false;
+
+	// loops make the cost dynamic
+	SmallVector<std::pair<const BasicBlock*, const BasicBlock*>, 8> Backedges;
+	FindFunctionBackedges(*F, Backedges);
+	if (!Backedges.empty())
+		return false;
+
+	// longest path over acyclic CFG in topological order
+	std::map<BasicBlock*, size_t> Paths;
+	std::map<BasicBlock*, size_t> Footprints;
+	size_t LongestPath = 0;
+	size_t LargestFootprint = 0;
+	ReversePostOrderTraversal<Function*> RPOT(F);
+	for (auto bi = RPOT.begin(); bi != RPOT.end(); ++bi) {
+		BasicBlock* BB = *bi;
+		size_t Path = 0;
+		size_t BBFootprint = 0;
+		std::set<LineKey> Lines;
+		for (auto it = pred_begin(BB), et = pred_end(BB); it != et; ++it) {
+			if (Paths.count(*it) && Paths[*it] > Path)
+				Path = Paths[*it];
+			if (Footprints.count(*it) && Footprints[*it] > BBFootprint)
+				BBFootprint = Footprints[*it];
+		}
+
+		for (BasicBlock::iterator ii = BB->begin(); ii != BB->end(); ++ii) {
+			Instruction* I = &*ii;
+			if (isa<InvokeInst>(I))
+				return false;
+			if (CallInst* call = dyn_cast<CallInst>(I)) {
+				Function* callee = call->getCalledFunction();
+				if (callee == F)
+					return false;  // recursion
+				if (isTxSafeFunc(callee)) {
+					Path += ExternalCallCost;
+				} else if (!isInternalFunc(callee)) {
+					// callees are summarized first (bottom-up), so any other
+					// local callee without summary has a dynamic cost
+					if (!hasFixedCost(callee))
+						return false;
+					Path += FixedCosts[callee];
+					BBFootprint += FixedFootprints[callee];
+				}
+			}
+			if (!isFreeInst(I))
+				Path += 1;
+			BBFootprint += getFootprint(I, Lines);
+		}
+
+		if (Path > InlineCostLimit)
+			return false;
+		Paths[BB] = Path;
+		Footprints[BB] = BBFootprint;
+		if (LongestPath < Path)
+			LongestPath = Path;
+		if (LargestFootprint < BBFootprint)
+			LargestFootprint = BBFootprint;
+	}
+
+	Cost = LongestPath;
+	Footprint = LargestFootprint;
+	return true;
+}
+
+void computeFixedCosts(Module& M) {
+	FixedCosts.clear();
+	FixedFootprints.clear();
+	if (FuncExplicitTrans || InlineCostLimit == 0)
+		return;
+
+	// bottom-up over call graph: callees are visited before callers;
+	// functions in (mutually) recursive SCCs have no static cost
+	CallGraph CG(M);
+	for (scc_iterator<CallGraph*> si = scc_begin(&CG); !si.isAtEnd(); ++si) {
+		const std::vector<CallGraphNode*>& SCC = *si;
+		if (SCC.size() != 1)
+			continue;
+		Function* F = SCC[0]->getFunction();
+		size_t Cost = 0, Footprint = 0;
+		if (F && computeFixedCost(F, Cost, Footprint)) {
+			FixedCosts[F] = Cost;
+			FixedFootprints[F] = Footprint;
+			FixedCostFuncs++;
+		}
+	}
+}
+
 
 class Transactifier {
 	LoopInfo* LI;
+	ScalarEvolution* SE;
 
 	std::set<BasicBlock*> Visited;
 	std::map<BasicBlock*, size_t> LongestPaths;
+	// footprint along longest paths and lines accessed since last increment
+	std::map<BasicBlock*, size_t> Footprints;
+	std::map<BasicBlock*, std::set<LineKey>> AccessedLines;
 
 	std::set<Instruction*> LocksToOptimize;
 
 public:
 
-	Transactifier(LoopInfo* _LI) {
+	Transactifier(LoopInfo* _LI, ScalarEvolution* _SE) {
 		LI = _LI;
+		SE = _SE;
 	}
 
 	void insertTxEnd(Instruction* I) {
@@ -188,13 +627,13 @@ public:
 	void insertTxStart(Instruction* I) {
 		TransNum++;  // bump statistic counter
 		IRBuilder<> irBuilder(I);
-		irBuilder.CreateCall(tx_start_func);
+		irBuilder.CreateCall(tx_start_func, irBuilder.getInt32(tx_next_site++));
 	}
 
 	void insertCondTxStart(Instruction* I) {
 		CondTransNum++;  // bump statistic counter
 		IRBuilder<> irBuilder(I);
-		irBuilder.CreateCall(tx_cond_start_func);
+		irBuilder.CreateCall(tx_cond_start_func, irBuilder.getInt32(tx_next_site++));
 	}
 
 	void assignLongestPath(BasicBlock* BB, size_t N) {
@@ -202,19 +641,30 @@ public:
 		LongestPaths.insert(std::pair<BasicBlock*, size_t>(BB, N));
 	}
 
-	void insertCounterIncrement(Instruction* I, size_t Inc) {
-		if (Inc <= 0 || Inc >= 1000000) // sanity check
+	void assignFootprint(BasicBlock* BB, size_t N) {
+		Footprints[BB] = N;
+		if (N == 0)
+			AccessedLines[BB].clear();
+	}
+
+	size_t getBBFootprint(BasicBlock* BB) {
+		return Footprints.count(BB) ? Footprints[BB] : 0;
+	}
+
+	void insertCounterIncrement(Instruction* I, size_t Inc, size_t Lines) {
+		if ((Inc <= 0 && Lines <= 0) || Inc >= 1000000 || Lines >= 1000000) // sanity check
 			return;
 
 		IRBuilder<> irBuilder(I);
-		irBuilder.CreateCall(tx_increment_func,
-			ConstantInt::get(getGlobalContext(), APInt(64, Inc)));
+		Value* IncVal = ConstantInt::get(getGlobalContext(), APInt(64, Inc));
+		Value* LinesVal = ConstantInt::get(getGlobalContext(), APInt(64, Lines));
+		irBuilder.CreateCall(tx_increment_func, {IncVal, LinesVal});
 	}
 
-	void insertCounterIncrement(BasicBlock* BB, size_t Inc) {
+	void insertCounterIncrement(BasicBlock* BB, size_t Inc, size_t Lines) {
 		Instruction* I = BB->getTerminator();
 		assert(I && "BB has no terminator");
-		insertCounterIncrement(I, Inc);
+		insertCounterIncrement(I, Inc, Lines);
 	}
 
 	size_t getNumAsmInstructions(BasicBlock* BB) {
@@ -247,6 +697,7 @@ public:
 
 	void initLongestPath(BasicBlock* BB) {
 		size_t LongestPath = 0;
+		size_t LargestFootprint = 0;
 		for (auto it = pred_begin(BB), et = pred_end(BB); it != et; ++it) {
 				BasicBlock* PredBB = *it;
 				// find a previously (due to toposort) calculated longest path
@@ -255,8 +706,12 @@ public:
 				if (LongestPaths.count(PredBB) == 0)  continue;
 				size_t PredPath = LongestPaths.find(PredBB)->second;
 				if (LongestPath < PredPath)  LongestPath = PredPath;
+				// footprint is maximized independently of instruction count
+				if (LargestFootprint < getBBFootprint(PredBB))  LargestFootprint = getBBFootprint(PredBB);
 		}
 		assignLongestPath(BB, LongestPath);
+		assignFootprint(BB, LargestFootprint);
+		AccessedLines[BB].clear();
 	}
 
 	void visitInst(Instruction* I, size_t instIdx) {
@@ -276,6 +731,9 @@ public:
 		assert(LongestPaths.count(I->getParent()) > 0);
 		size_t BBPath = LongestPaths.find(I->getParent())->second;
 		assignLongestPath(I->getParent(), BBPath + 1);
+		// and its footprint by lines accessed for the first time
+		BasicBlock* BB = I->getParent();
+		assignFootprint(BB, getBBFootprint(BB) + getFootprint(I, AccessedLines[BB]));
 
 		// ----- logic to insert Tx boundaries for invokes/calls and returns -----
 		unsigned Opcode = I->getOpcode();
@@ -292,10 +750,27 @@ public:
 				if (isInternalFunc(func))
 					return;
 
+				if (isTxSafeFunc(func) && !FuncExplicitTrans) {
+					// pure library func: stays inside current Tx, no boundaries
+					TxSafeCalls++;
+					size_t BBPath = LongestPaths.find(I->getParent())->second;
+					assignLongestPath(I->getParent(), BBPath + ExternalCallCost);
+					return;
+				}
+
+				if (hasFixedCost(func)) {
+					// callee has no Tx boundaries, just add its cost to path
+					FixedCostCalls++;
+					size_t BBPath = LongestPaths.find(I->getParent())->second;
+					assignLongestPath(I->getParent(), BBPath + FixedCosts[func]);
+					assignFootprint(BB, getBBFootprint(BB) + FixedFootprints[func]);
+					return;
+				}
+
 				// update the counter to inform callee
 				// NOTE: this increment is erased by BB optimization if redundant
 				size_t BBPath = LongestPaths.find(I->getParent())->second;
-				insertCounterIncrement(I, BBPath);
+				insertCounterIncrement(I, BBPath, getBBFootprint(BB));
 
 				BasicBlock::iterator instIt(I);
 				if (isCallToOutside(func)) {
@@ -329,6 +804,7 @@ public:
 				}
 
 				assignLongestPath(I->getParent(), 0);
+				assignFootprint(BB, 0);
 				return;
 			}
 
@@ -341,10 +817,17 @@ public:
 					// caller is local and thus inside Tx, no need to end Tx
 					// just update the counter to inform caller
 					size_t BBPath = LongestPaths.find(I->getParent())->second;
-					insertCounterIncrement(I, BBPath-1); // ignore Return
+					insertCounterIncrement(I, BBPath-1, getBBFootprint(BB)); // ignore Return
+					if (UndoLog) {
+						// software Tx cannot be rolled back past frame holding
+						// its checkpoint, commit it if started in this function
+						IRBuilder<> irBuilder(I);
+						irBuilder.CreateCall(tx_return_func);
+					}
 				}
 				// for sanity
 				assignLongestPath(I->getParent(), 0);
+				assignFootprint(BB, 0);
 				return;
 			}
 
@@ -417,6 +900,10 @@ public:
 		// optimize away conditional start & increment if it was a tight loop
 		assert(txincrementcall && "impossible: conditional start without counter increment in a tight loop");
 
+		size_t lines = 0;
+		if (ConstantInt* linesval = dyn_cast<ConstantInt>(txincrementcall->getArgOperand(1)))
+			lines = linesval->getZExtValue();
+
 		txcondstartcall->eraseFromParent();
 		txincrementcall->eraseFromParent();
 
@@ -425,11 +912,144 @@ public:
 		if (BasicBlock* preheader = L->getLoopPreheader()) {
 			size_t AVERAGE_TRIP_COUNT = 4;  // TODO: 4 is taken from top of my head
 			TerminatorInst* terminator = preheader->getTerminator();
-			insertCounterIncrement(terminator, BBPath * AVERAGE_TRIP_COUNT);
+			insertCounterIncrement(terminator, BBPath * AVERAGE_TRIP_COUNT, lines * AVERAGE_TRIP_COUNT);
 		}
 #endif
 	}
 
+	CallInst* findCallToFunc(BasicBlock* BB, Function* F) {
+		for (BasicBlock::iterator bi = BB->begin(); bi != BB->end(); ++bi)
+			if (CallInst* call = dyn_cast<CallInst>(bi))
+				if (call->getCalledFunction() == F)
+					return call;
+		return nullptr;
+	}
+
+	// returns true if loop was strip-mined (and needs no further optimization)
+	bool stripMineLoop(Loop* L) {
+#ifdef TRANS_STRIPMINE_LOOPS
+		// only innermost loops in canonical form with computable trip count
+		if (!L->empty())
+			return false;
+		BasicBlock* header    = L->getHeader();
+		BasicBlock* preheader = L->getLoopPreheader();
+		BasicBlock* latch     = L->getLoopLatch();
+		if (!preheader || !latch || !L->hasDedicatedExits())
+			return false;
+		if (!SE->hasLoopInvariantBackedgeTakenCount(L))
+			return false;
+
+		// calls to non-internal funcs use dynamic counter, loop is not simple
+		for (auto bi = L->block_begin(), be = L->block_end(); bi != be; ++bi)
+			for (BasicBlock::iterator ii = (*bi)->begin(); ii != (*bi)->end(); ++ii) {
+				if (isa<InvokeInst>(ii))
+					return false;
+				if (CallInst* call = dyn_cast<CallInst>(ii))
+					if (!isInternalFunc(call->getCalledFunction()) &&
+						!hasFixedCost(call->getCalledFunction()) &&
+						!isTxSafeFunc(call->getCalledFunction()))
+						return false;
+			}
+
+		// Tx boundary at header is either cond start (inserted in visitLoop)
+		// or threshold check (inserted in insertChecksOnLoopHeaders)
+		CallInst* txcondstartcall = findCallToFunc(header, tx_cond_start_func);
+		CallInst* txthresholdcall = findCallToFunc(header, tx_threshold_exceeded_func);
+		CallInst* txincrementcall = findCallToFunc(latch, tx_increment_func);
+		if ((!txcondstartcall && !txthresholdcall) || !txincrementcall)
+			return false;
+
+		// per-iteration cost is the longest path through the loop body,
+		// per-iteration footprint is the largest one
+		ConstantInt* costval = dyn_cast<ConstantInt>(txincrementcall->getArgOperand(0));
+		ConstantInt* linesval = dyn_cast<ConstantInt>(txincrementcall->getArgOperand(1));
+		if (!costval || costval->isZero() || !linesval)
+			return false;
+		uint64_t cost = costval->getZExtValue();
+		uint64_t lines = linesval->getZExtValue();
+
+		unsigned tripcount = SE->getSmallConstantTripCount(L);
+		if (tripcount > 0 && tripcount * cost <= LoopBudget &&
+				tripcount * lines <= LoopFootprintBudget && txcondstartcall) {
+			// whole loop fits into one chunk, account for it in preheader
+			LoopsInOneTx++;
+			txcondstartcall->eraseFromParent();
+			txincrementcall->eraseFromParent();
+			insertCounterIncrement(preheader, tripcount * cost, tripcount * lines);
+			return true;
+		}
+
+		// chunk is bounded by both instructions and footprint
+		uint64_t chunk = LoopBudget / cost;
+		if (lines > 0 && LoopFootprintBudget / lines < chunk)
+			chunk = LoopFootprintBudget / lines;
+		if (chunk < 2) {
+			// loop body is too large, per-iteration Tx is fine
+			return false;
+		}
+		LoopsStripMined++;
+
+		// chunk counter: iterations left in current chunk
+		// NOTE: at end of each chunk, its cost is added to dynamic counter
+		//       and Tx restarts only if runtime thresholds are exceeded
+		Type* Int64Ty = Type::getInt64Ty(header->getContext());
+		Constant* chunkval = ConstantInt::get(Int64Ty, chunk);
+
+		IRBuilder<> irBuilder(header->getFirstNonPHI());
+		PHINode* chunkphi = PHINode::Create(Int64Ty, 2, "tx.chunk", &header->front());
+		Value* restart = irBuilder.CreateICmpEQ(chunkphi, ConstantInt::get(Int64Ty, 0), "tx.chunk.done");
+		Value* chunklive = irBuilder.CreateSelect(restart, chunkval, chunkphi);
+		Value* chunknext = irBuilder.CreateSub(chunklive, ConstantInt::get(Int64Ty, 1), "tx.chunk.next");
+		for (auto pi = pred_begin(header), pe = pred_end(header); pi != pe; ++pi)
+			chunkphi->addIncoming(*pi == preheader ? chunkval : chunknext, *pi);
+
+		// end of chunk is rare, so hint branch as unlikely
+		Instruction* boundary = txthresholdcall ? txthresholdcall : txcondstartcall;
+		MDNode* weights = MDBuilder(header->getContext()).createBranchWeights(1, chunk);
+		Instruction* thenterm = SplitBlockAndInsertIfThen(restart, boundary, false, weights);
+		insertCounterIncrement(thenterm, chunk * cost, chunk * lines);
+		BasicBlock* thenBB = thenterm->getParent();
+		BasicBlock* tailBB = thenBB->getSingleSuccessor();
+
+		if (txthresholdcall) {
+			// Tx end & start are already in the block with checks, only
+			// check thresholds at end of chunk
+			IRBuilder<> thenBuilder(thenterm);
+			Value* exceeded = thenBuilder.CreateCall(tx_threshold_exceeded_func);
+			PHINode* flag = PHINode::Create(txthresholdcall->getType(), 2, "tx.chunk.exceeded", &tailBB->front());
+			flag->addIncoming(exceeded, thenBB);
+			flag->addIncoming(ConstantInt::get(txthresholdcall->getType(), 0), header);
+			txthresholdcall->replaceAllUsesWith(flag);
+			txthresholdcall->eraseFromParent();
+		} else {
+			txcondstartcall->moveBefore(thenterm);
+		}
+
+		// keep LoopInfo up to date with new BBs inside the loop
+		L->addBasicBlockToLoop(thenBB, *LI);
+		L->addBasicBlockToLoop(tailBB, *LI);
+		Visited.insert(thenBB);
+		Visited.insert(tailBB);
+		txincrementcall->eraseFromParent();
+
+		// on exit, account for iterations executed in current chunk
+		SmallVector<BasicBlock*, 8> ExitBlocks;
+		L->getUniqueExitBlocks(ExitBlocks);
+		for (auto ei = ExitBlocks.begin(), ee = ExitBlocks.end(); ei != ee; ++ei) {
+			IRBuilder<> exitBuilder(&*(*ei)->getFirstInsertionPt());
+			Value* done = exitBuilder.CreateSub(chunkval, chunknext);
+			exitBuilder.CreateCall(tx_increment_func, {
+				exitBuilder.CreateMul(done, ConstantInt::get(Int64Ty, cost)),
+				exitBuilder.CreateMul(done, ConstantInt::get(Int64Ty, lines))});
+		}
+
+		SE->forgetLoop(L);
+		return true;
+#else
+		return false;
+#endif
+	}
+
 	void insertChecksOnLoopHeaders(Loop* L) {
 #ifdef TRANS_INSERT_CHECKS_ON_LOOP_HEADERS
 		// earlier Swift pass must have inserted this code snippet:
@@ -491,6 +1111,8 @@ public:
 
 	    // go through toposorted BBs inside loop, saving their longest paths
 		LongestPaths.clear();
+		Footprints.clear();
+		AccessedLines.clear();
 		for (auto bi = DFS.beginRPO(); bi != DFS.endRPO(); ++bi) {
 			BasicBlock* BB = *bi;
 
@@ -505,14 +1127,16 @@ public:
 			for (auto li = LoopLatches.begin(), le = LoopLatches.end(); li != le; ++li) {
 				if (*li == BB) {
 					// this BB is a Latch, increment dynamic counter at its end
-					insertCounterIncrement(BB, LongestPath);
+					insertCounterIncrement(BB, LongestPath, getBBFootprint(BB));
 					assignLongestPath(BB, 0);
+					assignFootprint(BB, 0);
 					break;
 				}
 			}
 		}
 
-		optimizeLoop(L);
+		if (!stripMineLoop(L))
+			optimizeLoop(L);
 	}
 
 	bool isCallToFunc(Instruction* I, Function* F) {
@@ -535,16 +1159,50 @@ public:
 		return false;
 	}
 
-	int checkInstructionsInCriticalSection(std::set<Instruction*> &CSEndInsts, BasicBlock::iterator II, BasicBlock::iterator IE) {
+	bool isTxBoundary(Instruction* I) {
+		return isCallToFunc(I, tx_start_func) || isCallToFunc(I, tx_cond_start_func) ||
+			isCallToFunc(I, tx_end_func);
+	}
+
+	// can lock/unlock call be substituted by wrapper without Tx boundaries?
+	// outside funcs (pthread) are surrounded by Tx-end & Tx-start, local
+	// funcs (std::mutex) are followed by conditional Tx-start
+	bool hasRemovableTxBoundaries(CallInst* call) {
+		BasicBlock::iterator II(call);
+		if (II == call->getParent()->begin() || std::next(II) == call->getParent()->end())
+			return false;
+		Instruction* prevInst = &*std::prev(II);
+		Instruction* nextInst = &*std::next(II);
+		if (isCallToOutside(call->getCalledFunction()))
+			return isCallToFunc(prevInst, tx_end_func) && isCallToFunc(nextInst, tx_start_func);
+		return isCallToFunc(nextInst, tx_cond_start_func);
+	}
+
+	int checkInstructionsInCriticalSection(std::set<Instruction*> &CSEndInsts, LockKind Kind, BasicBlock::iterator II, BasicBlock::iterator IE) {
 		for (; II != IE; ++II) {
 			if (CallInst *call = dyn_cast<CallInst>(II)) {
-				if (isCallToFunc(call, "pthread_mutex_unlock")) {
+				LockFunc info;
+				if (getLockFunc(call->getCalledFunction(), info) && !info.isLock && info.kind == Kind) {
 					// found end of critical section, stop searching in this BB
+					if (!hasRemovableTxBoundaries(call))
+						return 2;
 					CSEndInsts.insert(call);
 					return 1;
 				}
-				if (isInternalFunc(call->getCalledFunction())) {
-					// this call is to internal function, just ignore it
+				if (isTxBoundary(call)) {
+					// Tx boundary inside critical section (e.g., loop header)
+					// would split it into several Txs; only boundaries right
+					// around lock/unlock are fine, they are removed anyway
+					BasicBlock::iterator nextII = std::next(II);
+					if (isa<CallInst>(nextII) && getLockFunc(cast<CallInst>(nextII)->getCalledFunction(), info) &&
+						!info.isLock && info.kind == Kind)
+						continue;
+					return 2;
+				}
+				if (isInternalFunc(call->getCalledFunction()) ||
+					isTxSafeFunc(call->getCalledFunction()) ||
+					hasFixedCost(call->getCalledFunction())) {
+					// this call has no Tx boundaries, just ignore it
 					continue;
 				}
 				// found some unidentified function call -- consider
@@ -564,44 +1222,60 @@ public:
 		return 0;
 	}
 
-	// TODO produce better code, this is ugly as hell
-	void analyzeCriticalSection(Instruction* CSStartInst) {
-		// starting from CSStartInst (which is a call to pthread_mutex_lock),
-		// find a corresponding call to pthread_mutex_unlock in this BB
-		// or in both immediate successors -- thus we restrict search
-		// only to "tiny" critical sections;
-		// it is ad-hoc solution, but hopefully enough for majority of cases
+	void analyzeCriticalSection(CallInst* CSStartInst, LockKind Kind, DominatorTreeBase<BasicBlock>& PDT) {
+		// starting from CSStartInst (a call to lock func), search all paths
+		// for corresponding calls to unlock funcs; the region in between
+		// must be single-entry (entered only from lock BB), free of Tx
+		// boundaries and calls, span at most CriticalSectionBlocks BBs, and
+		// unlock must post-dominate lock
 		std::set<Instruction*> CSEndInsts;
 		BasicBlock *BB = CSStartInst->getParent();
 		BasicBlock::iterator II(CSStartInst);
-		BasicBlock::iterator IE;
-
-		// search for end of critical section in this BB
-		int st = checkInstructionsInCriticalSection(CSEndInsts, std::next(II), BB->end());
-		if (st == 2) return;
-
-		if (st == 0) {
-			// still didn't find, search in immediate successors
-			if (succ_empty(BB)) return;
-			for (succ_iterator BI = succ_begin(BB), BE = succ_end(BB); BI != BE; ++BI) {
-				st = checkInstructionsInCriticalSection(CSEndInsts, BI->begin(), BI->end());
-				if (st == 2) return;
-
-				if (st == 0) {
-					// didn't find in immediate successors, Ok, last try --
-					// search in succs of succs (useful for Swift)
-					if (succ_empty(*BI)) return;
-					for (succ_iterator BBI = succ_begin(*BI), BBE = succ_end(*BI); BBI != BBE; ++BBI) {
-						st = checkInstructionsInCriticalSection(CSEndInsts, BBI->begin(), BBI->end());
-						if (st != 1) return;
-					}
-				}
+
+		if (!hasRemovableTxBoundaries(CSStartInst))
+			return;
+
+		// skip Tx start (or cond start) right after lock
+		std::set<BasicBlock*> Seen;
+		std::vector<std::pair<BasicBlock*, BasicBlock::iterator>> Worklist;
+		Worklist.push_back(std::make_pair(BB, std::next(std::next(II))));
+
+		while (!Worklist.empty()) {
+			BasicBlock* CurBB = Worklist.back().first;
+			BasicBlock::iterator CurII = Worklist.back().second;
+			Worklist.pop_back();
+
+			int st = checkInstructionsInCriticalSection(CSEndInsts, Kind, CurII, CurBB->end());
+			if (st == 2) return;
+			if (st == 1) continue;
+
+			// didn't find end of critical section in this BB, search in succs;
+			// function exit without unlock is not a critical section we handle
+			if (succ_empty(CurBB)) return;
+			for (succ_iterator SI = succ_begin(CurBB), SE = succ_end(CurBB); SI != SE; ++SI) {
+				if (*SI == BB) return;  // loop back to lock
+				if (!Seen.insert(*SI).second) continue;
+				if (Seen.size() > CriticalSectionBlocks) return;
+				Worklist.push_back(std::make_pair(*SI, SI->begin()));
 			}
 		}
 
 		// finally we have found region of critical section, memorize it
 		// for further optimization
-		assert(!CSEndInsts.empty());
+		if (CSEndInsts.empty()) return;
+
+		// no jumps into region other than from lock BB, otherwise wrapped
+		// unlock may run without wrapped lock
+		for (BasicBlock* RegionBB : Seen)
+			for (pred_iterator PI = pred_begin(RegionBB), PE = pred_end(RegionBB); PI != PE; ++PI)
+				if (*PI != BB && !Seen.count(*PI))
+					return;
+
+		// every path from lock reaches unlock (not e.g. unreachable)
+		for (Instruction* CSEndInst : CSEndInsts)
+			if (!PDT.dominates(CSEndInst->getParent(), BB))
+				return;
+
 		LocksToOptimize.insert(CSStartInst);
 		LocksToOptimize.insert(CSEndInsts.begin(), CSEndInsts.end());
 	}
@@ -609,41 +1283,53 @@ public:
 	void optimizeCriticalSections(Function &F) {
 #ifdef TRANS_OPTIMIZE_CRITICALSECTIONS
 		// first analyze critical sections and memorize only "tiny" ones
+		DominatorTreeBase<BasicBlock> PDT(true);
+		PDT.recalculate(F);
 		for (Function::iterator BB = F.begin(), BE = F.end(); BB != BE; ++BB)
 			for (auto II = BB->begin(), IE = BB->end(); II != IE; ++II) {
-				if (isCallToFunc(&*II, "pthread_mutex_lock"))
-					analyzeCriticalSection(&*II);
+				LockFunc info;
+				if (CallInst* call = dyn_cast<CallInst>(II))
+					if (getLockFunc(call->getCalledFunction(), info) && info.isLock)
+						analyzeCriticalSection(call, info.kind, PDT);
 			}
 
 		// now substitute "tiny" critical sections with HTM implementation,
 		// this includes (a) removing Tx-end & Tx-start around lock/unlock, and
 		// (b) substituting lock/unlock with wrappers provided by us
 		for (auto lockIt = LocksToOptimize.begin(); lockIt != LocksToOptimize.end(); ++lockIt) {
-			Instruction *LI = *lockIt;
-
-			// optimize only locks surrounded by Tx-end & Tx-start
-			BasicBlock::iterator II(LI);
+			CallInst *CI = cast<CallInst>(*lockIt);
+			BasicBlock::iterator II(CI);
 			Instruction *prevInst = &*std::prev(II);
-			if (!prevInst || !isCallToFunc(prevInst, tx_end_func))
-				continue;
 			Instruction *nextInst = &*std::next(II);
-			if (!nextInst || !isCallToFunc(nextInst, tx_start_func))
-				continue;
 
-			// remove Tx-end and Tx-start
-			prevInst->eraseFromParent();
+			// remove Tx-end and Tx-start (or cond start after local func)
+			if (isCallToFunc(prevInst, tx_end_func))
+				prevInst->eraseFromParent();
+			assert(isCallToFunc(nextInst, tx_start_func) || isCallToFunc(nextInst, tx_cond_start_func));
 			nextInst->eraseFromParent();
-
-			// substitute pthread lock/unlock with our wrappers
-			CallInst *CI = cast<CallInst>(LI);
-			if (isCallToFunc(CI, "pthread_mutex_lock")) {
-				CI->setCalledFunction(tx_pthread_mutex_lock_func);
-			} else if (isCallToFunc(CI, "pthread_mutex_unlock")) {
-				CI->setCalledFunction(tx_pthread_mutex_unlock_func);
-			} else {
-				assert(0 && "Tried to substitute function which is not lock/unlock while optimizing critical sections!");
+			CriticalSectionsElided++;
+
+			// substitute lock/unlock with our wrappers
+			LockFunc info;
+			bool found = getLockFunc(CI->getCalledFunction(), info);
+			assert(found && "Tried to substitute function which is not lock/unlock while optimizing critical sections!");
+			(void) found;
+			Function* wrapper = *info.wrapper;
+			if (CI->getFunctionType() == wrapper->getFunctionType()) {
+				CI->setCalledFunction(wrapper);
+				continue;
 			}
+
+			// std::mutex methods: different signature, lock is first field
+			IRBuilder<> irBuilder(CI);
+			Value* lock = irBuilder.CreatePointerCast(CI->getArgOperand(0),
+				wrapper->getFunctionType()->getParamType(0));
+			CallInst* newCI = irBuilder.CreateCall(wrapper, lock);
+			if (!CI->use_empty())
+				CI->replaceAllUsesWith(newCI);
+			CI->eraseFromParent();
 		}
+		LocksToOptimize.clear();
 #endif
 	}
 
@@ -706,7 +1392,45 @@ public:
 #endif
 	}
 
+	void insertUndoLog(Instruction* I, Value* ptr, Value* size) {
+		UndoLogNum++;  // bump statistic counter
+		IRBuilder<> irBuilder(I);
+		Value* addr = irBuilder.CreatePointerCast(ptr, irBuilder.getInt8PtrTy());
+		Value* len = irBuilder.CreateZExtOrTrunc(size, irBuilder.getInt64Ty());
+		irBuilder.CreateCall(tx_undo_log_func, {addr, len});
+	}
+
+	// software Tx runtime rolls memory back using old values logged here
+	void insertUndoLogs(Function& F) {
+		const DataLayout& DL = F.getParent()->getDataLayout();
+		Type* Int64Ty = Type::getInt64Ty(F.getContext());
+
+		for (Function::iterator BB = F.begin(), BE = F.end(); BB != BE; ++BB)
+			for (BasicBlock::iterator bi = BB->begin(); bi != BB->end(); ++bi) {
+				Instruction* I = &*bi;
+				if (StoreInst* SI = dyn_cast<StoreInst>(I)) {
+					uint64_t size = DL.getTypeStoreSize(SI->getValueOperand()->getType());
+					insertUndoLog(I, SI->getPointerOperand(), ConstantInt::get(Int64Ty, size));
+				} else if (AtomicRMWInst* RMW = dyn_cast<AtomicRMWInst>(I)) {
+					uint64_t size = DL.getTypeStoreSize(RMW->getValOperand()->getType());
+					insertUndoLog(I, RMW->getPointerOperand(), ConstantInt::get(Int64Ty, size));
+				} else if (AtomicCmpXchgInst* CAS = dyn_cast<AtomicCmpXchgInst>(I)) {
+					uint64_t size = DL.getTypeStoreSize(CAS->getNewValOperand()->getType());
+					insertUndoLog(I, CAS->getPointerOperand(), ConstantInt::get(Int64Ty, size));
+				} else if (MemIntrinsic* MI = dyn_cast<MemIntrinsic>(I)) {
+					insertUndoLog(I, MI->getRawDest(), MI->getLength());
+				}
+			}
+	}
+
 	void visitFunction(Function& F) {
+		if (hasFixedCost(&F)) {
+			// callers account for this function, no Tx boundaries needed
+			if (UndoLog)
+				insertUndoLogs(F);
+			return;
+		}
+
 		if (isCalledFromOutside(F.getName())) {
 			// caller cannot be inside Tx, so start Tx at beginning of function
 			insertTxStart(&F.front().front());
@@ -723,6 +1447,8 @@ public:
 
 		// next visit all the rest, outside-of-loop BBs of this function
 		LongestPaths.clear();
+		Footprints.clear();
+		AccessedLines.clear();
 		ReversePostOrderTraversal<Function*> RPOT(&F);
 		for (auto bi = RPOT.begin(); bi != RPOT.end(); ++bi) {
 			BasicBlock* BB = *bi;
@@ -741,6 +1467,9 @@ public:
 		optimizeCriticalSections(F);
 		optimizeBasicBlocks(F);
 		optimizeBasicBlocks(F);	 // in rare cases we need a second round of optimizations
+
+		if (UndoLog)
+			insertUndoLogs(F);
 	}
 
 };
@@ -763,6 +1492,10 @@ class TransactifyPass : public FunctionPass {
 
 		tx_pthread_mutex_lock_func   = M.getFunction("tx_pthread_mutex_lock");
 		tx_pthread_mutex_unlock_func = M.getFunction("tx_pthread_mutex_unlock");
+		tx_pthread_spin_lock_func    = M.getFunction("tx_pthread_spin_lock");
+		tx_pthread_spin_unlock_func  = M.getFunction("tx_pthread_spin_unlock");
+		tx_undo_log_func             = M.getFunction("tx_undo_log");
+		tx_return_func               = M.getFunction("tx_return");
 
 		assert(tx_cond_start_func && "tx_cond_start() is not declared");
 		assert(tx_start_func && "tx_start() is not declared");
@@ -772,6 +1505,16 @@ class TransactifyPass : public FunctionPass {
 		assert(tx_increment_func && "tx_increment() is not declared");
 		assert(tx_pthread_mutex_lock_func && "tx_pthread_mutex_lock() is not declared");
 		assert(tx_pthread_mutex_unlock_func && "tx_pthread_mutex_unlock() is not declared");
+		assert(tx_pthread_spin_lock_func && "tx_pthread_spin_lock() is not declared");
+		assert(tx_pthread_spin_unlock_func && "tx_pthread_spin_unlock() is not declared");
+		assert((!UndoLog || tx_undo_log_func) && "tx_undo_log() is not declared (requires tx_stm.c runtime)");
+		assert((!UndoLog || tx_return_func) && "tx_return() is not declared (requires tx_stm.c runtime)");
+
+		loadFuncList(SafeFuncsFile, TxSafeFuncs);
+		loadFuncList(UnsafeFuncsFile, TxUnsafeFuncs);
+
+		inferCalledFromOutside(M);
+		computeFixedCosts(M);
 
 		return false;
 	}
@@ -782,7 +1525,8 @@ class TransactifyPass : public FunctionPass {
 			return false;
 
 		LoopInfo& LI = getAnalysis<LoopInfoWrapperPass>().getLoopInfo();
-		Transactifier Trans(&LI);
+		ScalarEvolution& SE = getAnalysis<ScalarEvolutionWrapperPass>().getSE();
+		Transactifier Trans(&LI, &SE);
 		Trans.visitFunction(F);
 
 		// inform that we always modify a function
@@ -796,6 +1540,7 @@ class TransactifyPass : public FunctionPass {
 	virtual void getAnalysisUsage(AnalysisUsage& AU) const {
 		AU.addRequired<LoopInfoWrapperPass>();
 		AU.addPreserved<LoopInfoWrapperPass>();
+		AU.addRequired<ScalarEvolutionWrapperPass>();
 
 		FunctionPass::getAnalysisUsage(AU);
 	}
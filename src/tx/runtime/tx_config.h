@@ -0,0 +1,213 @@
+#ifndef TX_CONFIG_H
+#define TX_CONFIG_H
+
+// Tuning knobs of HAFT runtimes. Macros below (overridable via
+// TX_RUNTIME_FLAGS, e.g. -D THRESHOLD=3000) are only compile-time defaults;
+// at process start, tx_config_init() reads the file named by $HAFT_CONFIG
+// and then the environment, so that knobs can be tuned per deployment
+// without rebuilding:
+//
+//   # haft.cfg -- one knob per line, same names as environment variables
+//   HAFT_THRESHOLD=2000
+//   HAFT_MAX_RETRIES=4
+//
+// Environment variables override the config file. Knobs a runtime has no
+// policy for (e.g. backoff in tx_stm.c) are accepted and ignored.
+//
+// NOTE: knobs are written only before main() and live in their own cache
+//       line, so reading one on the hot path is a single load and never
+//       causes Tx conflicts.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// initial instruction budget of Tx (per site in HTM runtimes)
+#ifndef THRESHOLD
+#define THRESHOLD 500
+#endif
+
+// budget of estimated Tx footprint in cache lines (written lines count
+// -tx-write-weight times); instruction count is only the secondary limit
+#ifndef FOOTPRINT_THRESHOLD
+#define FOOTPRINT_THRESHOLD 2048
+#endif
+
+#ifndef MAX_RETRIES
+#define MAX_RETRIES 2
+#endif
+
+// per-site adaptive thresholds (HTM): start at THRESHOLD, halve after
+// capacity abort, grow by THRESHOLD_STEP after commit, stay in [MIN, MAX];
+// unless set explicitly, MAX and STEP scale with a configured THRESHOLD
+#ifndef MIN_THRESHOLD
+#define MIN_THRESHOLD 16
+#endif
+
+#ifndef MAX_THRESHOLD
+#define MAX_THRESHOLD (THRESHOLD * 16)
+#endif
+
+#ifndef THRESHOLD_STEP
+#define THRESHOLD_STEP (THRESHOLD / 8 + 1)
+#endif
+
+// randomized exponential backoff on conflicts (tx_intel.c): spin up to
+// min(BACKOFF_BASE << retry, MAX_BACKOFF) pauses
+#ifndef BACKOFF_BASE
+#define BACKOFF_BASE 16
+#endif
+
+#ifndef MAX_BACKOFF
+#define MAX_BACKOFF 4096
+#endif
+
+// per-lock adaptive elision (HTM), see tx_elision.h
+#ifndef LOCK_ABORT_LIMIT
+#define LOCK_ABORT_LIMIT 3
+#endif
+
+#ifndef LOCK_SKIP_BASE
+#define LOCK_SKIP_BASE 16
+#endif
+
+#ifndef LOCK_MAX_PENALTY
+#define LOCK_MAX_PENALTY 8
+#endif
+
+#ifndef TX_CONFIG_LINE
+#define TX_CONFIG_LINE 256
+#endif
+
+struct tx_config {
+	long threshold;
+	long footprint_threshold;
+	long max_retries;
+	long min_threshold;
+	long max_threshold;
+	long threshold_step;
+	long backoff_base;
+	long max_backoff;
+	long lock_abort_limit;
+	long lock_skip_base;
+	long lock_max_penalty;
+} __attribute__((aligned(64)));
+
+struct tx_config __txconfig = {
+	THRESHOLD,
+	FOOTPRINT_THRESHOLD,
+	MAX_RETRIES,
+	MIN_THRESHOLD,
+	MAX_THRESHOLD,
+	THRESHOLD_STEP,
+	BACKOFF_BASE,
+	MAX_BACKOFF,
+	LOCK_ABORT_LIMIT,
+	LOCK_SKIP_BASE,
+	LOCK_MAX_PENALTY,
+};
+
+struct tx_config_knob {
+	const char *name;
+	long *value;
+	long min;      // smallest sane value, others are rejected
+	int set;       // set by config file or environment?
+};
+
+static struct tx_config_knob tx_config_knobs[] = {
+	{"HAFT_THRESHOLD",           &__txconfig.threshold,           1, 0},
+	{"HAFT_FOOTPRINT_THRESHOLD", &__txconfig.footprint_threshold, 1, 0},
+	{"HAFT_MAX_RETRIES",         &__txconfig.max_retries,         1, 0},
+	{"HAFT_MIN_THRESHOLD",       &__txconfig.min_threshold,       1, 0},
+	{"HAFT_MAX_THRESHOLD",       &__txconfig.max_threshold,       1, 0},
+	{"HAFT_THRESHOLD_STEP",      &__txconfig.threshold_step,      0, 0},
+	{"HAFT_BACKOFF_BASE",        &__txconfig.backoff_base,        1, 0},
+	{"HAFT_MAX_BACKOFF",         &__txconfig.max_backoff,         1, 0},
+	{"HAFT_LOCK_ABORT_LIMIT",    &__txconfig.lock_abort_limit,    1, 0},
+	{"HAFT_LOCK_SKIP_BASE",      &__txconfig.lock_skip_base,      0, 0},
+	{"HAFT_LOCK_MAX_PENALTY",    &__txconfig.lock_max_penalty,    0, 0},
+};
+
+#define TX_CONFIG_KNOBS (sizeof(tx_config_knobs) / sizeof(tx_config_knobs[0]))
+
+static struct tx_config_knob *tx_config_knob(const char *name) {
+	unsigned i;
+	for (i = 0; i < TX_CONFIG_KNOBS; i++)
+		if (strcmp(tx_config_knobs[i].name, name) == 0)
+			return &tx_config_knobs[i];
+	return NULL;
+}
+
+static void tx_config_set(struct tx_config_knob *knob, const char *str, const char *origin) {
+	char *end;
+	long value = strtol(str, &end, 0);
+	while (*end == ' ' || *end == '\t')
+		end++;
+	if (end == str || *end || value < knob->min) {
+		fprintf(stderr, "haft: ignoring invalid %s=%s (%s)\n", knob->name, str, origin);
+		return;
+	}
+	*knob->value = value;
+	knob->set = 1;
+}
+
+static void tx_config_read_file(const char *path) {
+	char line[TX_CONFIG_LINE];
+	FILE *f = fopen(path, "r");
+	if (!f) {
+		fprintf(stderr, "haft: cannot open config file %s\n", path);
+		return;
+	}
+	while (fgets(line, sizeof(line), f)) {
+		char *key = line, *eq, *end;
+		struct tx_config_knob *knob;
+		line[strcspn(line, "\r\n")] = '\0';
+		while (*key == ' ' || *key == '\t')
+			key++;
+		if (*key == '#' || *key == '\0')
+			continue;
+		eq = strchr(key, '=');
+		if (!eq) {
+			fprintf(stderr, "haft: malformed line in %s: %s\n", path, line);
+			continue;
+		}
+		for (end = eq; end > key && (end[-1] == ' ' || end[-1] == '\t'); end--);
+		*end = '\0';
+		knob = tx_config_knob(key);
+		if (!knob) {
+			fprintf(stderr, "haft: unknown knob %s in %s\n", key, path);
+			continue;
+		}
+		tx_config_set(knob, eq + 1, path);
+	}
+	fclose(f);
+}
+
+// runs before constructors of the application, which may already start Txs
+__attribute__((constructor(101)))
+void tx_config_init(void) {
+	unsigned i;
+	const char *path = getenv("HAFT_CONFIG");
+	if (path && *path)
+		tx_config_read_file(path);
+
+	for (i = 0; i < TX_CONFIG_KNOBS; i++) {
+		const char *str = getenv(tx_config_knobs[i].name);
+		if (str)
+			tx_config_set(&tx_config_knobs[i], str, "environment");
+	}
+
+	// adaptive range follows configured threshold unless given explicitly
+	if (__txconfig.threshold != THRESHOLD) {
+		if (!tx_config_knob("HAFT_MAX_THRESHOLD")->set)
+			__txconfig.max_threshold = __txconfig.threshold * 16;
+		if (!tx_config_knob("HAFT_THRESHOLD_STEP")->set)
+			__txconfig.threshold_step = __txconfig.threshold / 8 + 1;
+	}
+	if (__txconfig.min_threshold > __txconfig.threshold)
+		__txconfig.min_threshold = __txconfig.threshold;
+	if (__txconfig.max_threshold < __txconfig.threshold)
+		__txconfig.max_threshold = __txconfig.threshold;
+}
+
+#endif /* TX_CONFIG_H */
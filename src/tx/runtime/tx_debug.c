@@ -1,55 +1,68 @@
 #include <stdio.h>
 #include <pthread.h>
+#include <unistd.h>
+
+#include "tx_config.h"
+
+#define TX_STATS_RUNTIME
+#include "tx_stats.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-#ifndef MAX_RETRIES
-#define MAX_RETRIES 2
-#endif
-
-#ifndef THRESHOLD
-#define THRESHOLD 500
+#ifdef TX_ILR_SIGNATURE
+// ILR runtime: verifies signature of folded checks, aborts Tx on mismatch
+extern void SWIFT$verify(void);
 #endif
 
 // thread-local dynamic counter (implemented as mov %fs:0xfc,%rax)
 __thread long __txinstcounter = -1;
+__thread long __txfootprint = -1;
 
 __attribute__((always_inline))
-void tx_start(void) {
-  printf("%s\n", "start transaction");
-  __txinstcounter = THRESHOLD;
+void tx_start(int site) {
+  printf("%s %d\n", "start transaction at site", site);
+  TX_STAT_INC(starts);
+  __txinstcounter = __txconfig.threshold;
+  __txfootprint = __txconfig.footprint_threshold;
 }
 
 __attribute__((always_inline))
 void tx_end(void) {
+#ifdef TX_ILR_SIGNATURE
+  SWIFT$verify();
+#endif
   printf("%s\n", "end transaction");
+  TX_STAT_INC(commits);
 }
 
 __attribute__((always_inline))
-void tx_cond_start(void) {
-  if (__txinstcounter > 0) 
+void tx_cond_start(int site) {
+  if (__txinstcounter > 0 && __txfootprint > 0)
     return;
   tx_end();
-  tx_start();
+  tx_start(site);
 }
 
 __attribute__((always_inline))
 void tx_abort(void) {
   printf("%s\n", "abort transaction");
+  TX_STAT_INC(aborts_explicit);
+  TX_STAT_INC(ilr_detections);
 }
 
 __attribute__((always_inline))
 int tx_threshold_exceeded(void) {
-  if (__txinstcounter > 0)
+  if (__txinstcounter > 0 && __txfootprint > 0)
     return 0;
   return 1;
 }
 
 __attribute__((always_inline))
-void tx_increment(unsigned long inc) {
+void tx_increment(unsigned long inc, unsigned long lines) {
   __txinstcounter -= (long)inc;
+  __txfootprint -= (long)lines;
 }
 
 // pthread lock/unlock wrappers
@@ -60,6 +73,7 @@ int tx_pthread_mutex_lock(pthread_mutex_t *m) {
   }
   // in Tx and lock is free, use optimistic HTM locking
 //   __txinstcounter -= 10;
+  TX_STAT_INC(elided_locks);
   return 0;
 }
 
@@ -72,15 +86,40 @@ int tx_pthread_mutex_unlock(pthread_mutex_t *m) {
   return 0;
 }
 
+int tx_pthread_spin_lock(pthread_spinlock_t *l) {
+  if (0) {
+    // not in Tx or lock is not free, fall back to usual lock
+    return pthread_spin_lock(l);
+  }
+  TX_STAT_INC(elided_locks);
+  return 0;
+}
+
+int tx_pthread_spin_unlock(pthread_spinlock_t *l) {
+  if (0) {
+    // not in Tx, fall back to usual unlock
+    return pthread_spin_unlock(l);
+  }
+  return 0;
+}
+
+// output of my_printf & co.: no real Tx, write directly
+long tx_write(int fd, const void *buf, unsigned long n) {
+  return write(fd, buf, n);
+}
+
 // dummy vars, so that LLVM does not optimize function declarations away
-void (*dummy_tx_start_var)(void) = tx_start;
-void (*dummy_tx_cond_start_var)(void) = tx_cond_start;
+void (*dummy_tx_start_var)(int) = tx_start;
+void (*dummy_tx_cond_start_var)(int) = tx_cond_start;
 void (*dummy_tx_end_var)(void)   = tx_end;
 void (*dummy_tx_abort_var)(void) = tx_abort;
 int  (*dummy_tx_threshold_exceeded_var)(void) = tx_threshold_exceeded;
-void (*dummy_tx_increment_var)(unsigned long) = tx_increment;
+void (*dummy_tx_increment_var)(unsigned long, unsigned long) = tx_increment;
+long (*dummy_tx_write_var)(int, const void *, unsigned long) = tx_write;
 int  (*dummy_tx_pthread_mutex_lock)(pthread_mutex_t *) = tx_pthread_mutex_lock;
 int  (*dummy_tx_pthread_mutex_unlock)(pthread_mutex_t *) = tx_pthread_mutex_unlock;
+int  (*dummy_tx_pthread_spin_lock)(pthread_spinlock_t *) = tx_pthread_spin_lock;
+int  (*dummy_tx_pthread_spin_unlock)(pthread_spinlock_t *) = tx_pthread_spin_unlock;
 
 #ifdef __cplusplus
 }
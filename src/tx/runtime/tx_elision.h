@@ -0,0 +1,117 @@
+#ifndef TX_ELISION_H
+#define TX_ELISION_H
+
+// Per-lock adaptive lock elision for HTM runtimes (tx_intel.c, tx_ibm.c).
+// Each thread keeps a small table of slots indexed by hashed lock address.
+// A lock that repeatedly makes Txs fall back (or is found busy) is taken
+// for real for the next LOCK_SKIP_BASE << penalty acquisitions, after which
+// elision is probed again; penalty grows while probing keeps failing and is
+// reset after a committed elision. Knobs are in tx_config.h.
+//
+// NOTE: state is thread-local, so that updating it never causes conflicts;
+//       updates done inside Tx persist only if Tx commits, so failures are
+//       recorded outside Tx (after Tx end or in fallback path).
+
+#ifndef TX_LOCK_SLOTS
+#define TX_LOCK_SLOTS 256   // must be power of two
+#endif
+
+struct tx_lock_slot {
+	unsigned aborts;    // failures since last disabling or success
+	unsigned skip;      // acquisitions left with elision disabled
+	unsigned penalty;   // log2 of next disabling period
+};
+
+// per-thread state, defined by the runtime
+extern __thread struct tx_lock_slot __txlocks[TX_LOCK_SLOTS];
+
+// set by Tx start when Tx falls back after aborts (other than capacity);
+// the first lock acquired in the fallback path is blamed for them
+extern __thread int __txlockblame;
+
+// locks this thread acquired for real (not elided); a Tx may be started
+// while one is held, so its unlock must not be taken for an elided one
+#ifndef TX_HELD_LOCKS
+#define TX_HELD_LOCKS 32
+#endif
+
+extern __thread void *__txheld[TX_HELD_LOCKS];
+extern __thread int   __txnheld;
+extern __thread int   __txheldoverflow;  // real locks not in __txheld
+
+__attribute__((always_inline))
+static inline struct tx_lock_slot *tx_lock_slot(void *lock) {
+	unsigned long h = (unsigned long)lock >> 3;
+	h ^= h >> 7;
+	h ^= h >> 13;
+	return &__txlocks[h & (TX_LOCK_SLOTS - 1)];
+}
+
+// outside Tx: elision of this lock failed
+__attribute__((always_inline))
+static inline void tx_lock_failed(struct tx_lock_slot *slot) {
+	if (++slot->aborts < __txconfig.lock_abort_limit)
+		return;
+	slot->aborts = 0;
+	slot->skip = __txconfig.lock_skip_base << slot->penalty;
+	if (slot->penalty < __txconfig.lock_max_penalty)
+		slot->penalty++;
+}
+
+// inside Tx: lock was elided (recorded only if Tx commits)
+__attribute__((always_inline))
+static inline void tx_lock_elided(struct tx_lock_slot *slot) {
+	if (slot->aborts || slot->penalty) {
+		slot->aborts = 0;
+		slot->penalty = 0;
+	}
+}
+
+// outside Tx: lock is taken for real because elision is disabled or lock
+// was busy (which would abort Tx anyway)
+__attribute__((always_inline))
+static inline void tx_lock_skipped(struct tx_lock_slot *slot) {
+	if (slot->skip > 0)
+		slot->skip--;
+	else
+		tx_lock_failed(slot);
+}
+
+// outside Tx: lock acquired in (fallback) non-Tx path
+__attribute__((always_inline))
+static inline void tx_lock_outside(void *lock) {
+	if (__txlockblame) {
+		__txlockblame = 0;
+		tx_lock_failed(tx_lock_slot(lock));
+	}
+}
+
+// lock was acquired for real
+__attribute__((always_inline))
+static inline void tx_lock_held(void *lock) {
+	if (__txnheld < TX_HELD_LOCKS)
+		__txheld[__txnheld++] = lock;
+	else
+		__txheldoverflow++;
+}
+
+// is lock (with lock word *word) held for real by this thread? forgets it;
+// if the table overflowed, a lock word that is taken while we are in Tx
+// can only be ours, since elided locks are free and in the Tx read set
+__attribute__((always_inline))
+static inline int tx_lock_release(void *lock, volatile int *word) {
+	int i;
+	for (i = __txnheld - 1; i >= 0; i--) {
+		if (__txheld[i] == lock) {
+			__txheld[i] = __txheld[--__txnheld];
+			return 1;
+		}
+	}
+	if (__txheldoverflow && *word != 0) {
+		__txheldoverflow--;
+		return 1;
+	}
+	return 0;
+}
+
+#endif /* TX_ELISION_H */
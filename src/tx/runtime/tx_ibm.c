@@ -1,56 +1,152 @@
 #include <htmxlintrin.h>
 #include <pthread.h>
 
+#include "tx_config.h"
+
+#define TX_STATS_RUNTIME
+#include "tx_stats.h"
+#include "tx_elision.h"
+#include "tx_output.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-#ifndef MAX_RETRIES
-#define MAX_RETRIES 2
+// per-site adaptive thresholds, see tx_intel.c
+#ifndef TX_SITES
+#define TX_SITES 1024   // must be power of two
 #endif
 
-#ifndef THRESHOLD
-#define THRESHOLD 500
+#ifdef TX_ILR_SIGNATURE
+// ILR runtime: verifies signature of folded checks, aborts Tx on mismatch
+extern void SWIFT$verify(void);
 #endif
 
 // thread-local dynamic counter (implemented as mov %fs:0xfc,%rax)
 __thread long __txinstcounter = -1;
+__thread long __txfootprint = -1;
+
+// per-lock elision state, see tx_elision.h
+__thread struct tx_lock_slot __txlocks[TX_LOCK_SLOTS];
+__thread int   __txlockblame = 0;
+__thread void *__txheld[TX_HELD_LOCKS];
+__thread int   __txnheld = 0;
+__thread int   __txheldoverflow = 0;
+
+// thread-local per-site thresholds (0 = not yet used) and site of current Tx
+__thread long __txthresholds[TX_SITES];
+__thread int  __txsite = -1;
+
+// deferred output of Tx, see tx_output.h
+__thread char     __txoutput[TX_OUTPUT_SIZE];
+__thread unsigned __txoutlen = 0;
+
+__attribute__((noinline))
+void tx_output_flush(void) {
+	unsigned pos = 0;
+	while (pos < __txoutlen) {
+		struct tx_output_chunk *chunk = (struct tx_output_chunk *) (__txoutput + pos);
+		tx_output_write(chunk->fd, (const char *) (chunk + 1), chunk->len);
+		pos += TX_OUTPUT_CHUNK(chunk->len);
+	}
+	__txoutlen = 0;
+}
+
+__attribute__((always_inline))
+static inline long *tx_site_threshold(int site) {
+	long *threshold = &__txthresholds[site & (TX_SITES - 1)];
+	if (*threshold == 0)
+		*threshold = __txconfig.threshold;
+	return threshold;
+}
 
 __attribute__((always_inline))
-void tx_start(void) {
+void tx_start(int site) {
 	int nretries = 0;
+	int started = 0;
+	long *threshold = tx_site_threshold(site);
+	__txsite = site;
+	unsigned long texasru = 0;
 	while (1) {
 		nretries++;
+		TX_STAT_INC(starts);
 		unsigned status = __builtin_tbegin(1);
 		if (status) {
             // successful start
+			started = 1;
 			break; 
 		}
 		//  abort handler
-		if (nretries == MAX_RETRIES) {
+		texasru = __builtin_get_texasru();
+		if (_TEXASRU_ABORT(texasru)) {
+			TX_STAT_INC(aborts_explicit);
+			if (_TEXASRU_FAILURE_CODE(texasru) == 0x40)
+				TX_STAT_INC(ilr_detections);
+		} else if (_TEXASRU_TRANSACTION_CONFLICT(texasru) ||
+				_TEXASRU_NON_TRANSACTIONAL_CONFLICT(texasru) ||
+				_TEXASRU_TRANSLATION_INVALIDATION_CONFLICT(texasru) ||
+				_TEXASRU_SELF_INDUCED_CONFLICT(texasru)) {
+			TX_STAT_INC(aborts_conflict);
+		} else if (_TEXASRU_FOOTPRINT_OVERFLOW(texasru)) {
+			TX_STAT_INC(aborts_capacity);
+		} else {
+			TX_STAT_INC(aborts_other);
+		}
+
+		if (_TEXASRU_FOOTPRINT_OVERFLOW(texasru)) {
+			// Tx started at this site does not fit into cache, shrink it
+			*threshold /= 2;
+			if (*threshold < __txconfig.min_threshold)
+				*threshold = __txconfig.min_threshold;
+		}
+		if (nretries == __txconfig.max_retries) {
+			break;
+		}
+		if (_TEXASRU_FAILURE_PERSISTENT(texasru) &&
+				!_TEXASRU_FOOTPRINT_OVERFLOW(texasru)) {
+			// persistent failure, re-execution will abort again
 			break;
 		}
+		TX_STAT_INC(retries);
 	}
+	if (!started)
+		TX_STAT_INC(fallbacks);
+	// blame a lock in fallback path unless Tx simply was too large
+	__txlockblame = !started && !_TEXASRU_FOOTPRINT_OVERFLOW(texasru);
     // no matter how we exit, start counter anew
-    __txinstcounter = THRESHOLD;
+    __txinstcounter = *threshold;
+    __txfootprint = __txconfig.footprint_threshold * *threshold / __txconfig.threshold;
 	return;
 }
 
 __attribute__((always_inline))
 void tx_end(void) {
+#ifdef TX_ILR_SIGNATURE
+	SWIFT$verify();
+#endif
 	unsigned char state = __builtin_ttest();
 	if (_HTM_STATE(state) == _HTM_TRANSACTIONAL) { 
 		 __builtin_tend(1);
+		TX_STAT_INC(commits);
+		if (__txoutlen)
+			tx_output_flush();
+		// Tx committed, try a longer one from the same site next time
+		if (__txsite >= 0) {
+			long *threshold = tx_site_threshold(__txsite);
+			*threshold += __txconfig.threshold_step;
+			if (*threshold > __txconfig.max_threshold)
+				*threshold = __txconfig.max_threshold;
+		}
 	}
 	return;
 }
 
 __attribute__((always_inline))
-void tx_cond_start(void) {
-  if (__txinstcounter > 0) 
+void tx_cond_start(int site) {
+  if (__txinstcounter > 0 && __txfootprint > 0)
     return;
   tx_end();
-  tx_start();
+  tx_start(site);
 }
 
 __attribute__((always_inline))
@@ -61,45 +157,133 @@ void tx_abort(void) {
 
 __attribute__((always_inline))
 int tx_threshold_exceeded(void) {
-  if (__txinstcounter > 0)
+  if (__txinstcounter > 0 && __txfootprint > 0)
     return 0;
   return 1;
 }
 
 __attribute__((always_inline))
-void tx_increment(unsigned long inc) {
+void tx_increment(unsigned long inc, unsigned long lines) {
   __txinstcounter -= (long)inc;
+  __txfootprint -= (long)lines;
 }
 
 // pthread lock/unlock wrappers
+// locks acquired for real are recorded (see tx_elision.h): a Tx may be
+// started inside their critical section, and their unlock must not be
+// mistaken for the unlock of an elided lock
+__attribute__((always_inline))
+static inline int tx_mutex_lock_real(pthread_mutex_t *m) {
+  int ret = pthread_mutex_lock(m);
+  if (ret == 0)
+    tx_lock_held(m);
+  return ret;
+}
+
 int tx_pthread_mutex_lock(pthread_mutex_t *m) {
-  if (_HTM_STATE(__builtin_ttest()) != _HTM_TRANSACTIONAL || ((int *)m)[0] != 0) {
-    // not in Tx or lock is not free, fall back to usual lock
-    return pthread_mutex_lock(m);
+  if (_HTM_STATE(__builtin_ttest()) != _HTM_TRANSACTIONAL) {
+    // not in Tx, fall back to usual lock
+    tx_lock_outside(m);
+    return tx_mutex_lock_real(m);
+  }
+  struct tx_lock_slot *slot = tx_lock_slot(m);
+  if (slot->skip > 0 || ((int *)m)[0] != 0) {
+    // elision disabled or lock is not free: instead of aborting on it,
+    // commit Tx and use usual lock
+    tx_end();
+    tx_lock_skipped(slot);
+    return tx_mutex_lock_real(m);
   }
   // in Tx and lock is free, use optimistic HTM locking
 //   __txinstcounter -= 10;
+  tx_lock_elided(slot);
+  TX_STAT_INC(elided_locks);  // counted only if Tx commits
   return 0;
 }
 
 int tx_pthread_mutex_unlock(pthread_mutex_t *m) {
+  if (tx_lock_release(m, (volatile int *)m)) {
+    // acquired for real: commit Tx started in critical section (if any)
+    // before unlocking; next cond start begins new Tx
+    tx_end();
+    __txinstcounter = 0;
+    return pthread_mutex_unlock(m);
+  }
   if (_HTM_STATE(__builtin_ttest()) != _HTM_TRANSACTIONAL) {
     // not in Tx, fall back to usual unlock
     return pthread_mutex_unlock(m);
   }
-  // in Tx, we know that we used optimistic HTM locking, so nothing to do
+  // in Tx and lock not acquired for real, so it was elided: nothing to do
+  return 0;
+}
+
+__attribute__((always_inline))
+static inline int tx_spin_lock_real(pthread_spinlock_t *l) {
+  int ret = pthread_spin_lock(l);
+  if (ret == 0)
+    tx_lock_held((void *)l);
+  return ret;
+}
+
+int tx_pthread_spin_lock(pthread_spinlock_t *l) {
+  if (_HTM_STATE(__builtin_ttest()) != _HTM_TRANSACTIONAL) {
+    // not in Tx, fall back to usual lock
+    tx_lock_outside((void *)l);
+    return tx_spin_lock_real(l);
+  }
+  struct tx_lock_slot *slot = tx_lock_slot((void *)l);
+  if (slot->skip > 0 || *(volatile int *)l != 0) {
+    // elision disabled or lock is not free, see tx_pthread_mutex_lock
+    tx_end();
+    tx_lock_skipped(slot);
+    return tx_spin_lock_real(l);
+  }
+  // in Tx and lock is free, use optimistic HTM locking
+  tx_lock_elided(slot);
+  TX_STAT_INC(elided_locks);  // counted only if Tx commits
   return 0;
 }
 
+int tx_pthread_spin_unlock(pthread_spinlock_t *l) {
+  if (tx_lock_release((void *)l, (volatile int *)l)) {
+    // acquired for real, see tx_pthread_mutex_unlock
+    tx_end();
+    __txinstcounter = 0;
+    return pthread_spin_unlock(l);
+  }
+  if (_HTM_STATE(__builtin_ttest()) != _HTM_TRANSACTIONAL) {
+    // not in Tx, fall back to usual unlock
+    return pthread_spin_unlock(l);
+  }
+  // in Tx and lock not acquired for real, so it was elided: nothing to do
+  return 0;
+}
+
+// deferred output of my_printf & co., see tx_output.h
+long tx_write(int fd, const void *buf, unsigned long n) {
+  if (_HTM_STATE(__builtin_ttest()) == _HTM_TRANSACTIONAL) {
+    if (tx_output_append(fd, buf, n))
+      return n;
+    // does not fit into buffer: syscall aborts Tx, and its re-execution
+    // outside Tx writes directly
+  } else if (__txoutlen) {
+    tx_output_flush();
+  }
+  return write(fd, buf, n);
+}
+
 // dummy vars, so that LLVM does not optimize function declarations away
-void (*dummy_tx_start_var)(void) = tx_start;
-void (*dummy_tx_cond_start_var)(void) = tx_cond_start;
+void (*dummy_tx_start_var)(int) = tx_start;
+void (*dummy_tx_cond_start_var)(int) = tx_cond_start;
 void (*dummy_tx_end_var)(void)   = tx_end;
 void (*dummy_tx_abort_var)(void) = tx_abort;
 int  (*dummy_tx_threshold_exceeded_var)(void) = tx_threshold_exceeded;
-void (*dummy_tx_increment_var)(unsigned long) = tx_increment;
+void (*dummy_tx_increment_var)(unsigned long, unsigned long) = tx_increment;
+long (*dummy_tx_write_var)(int, const void *, unsigned long) = tx_write;
 int  (*dummy_tx_pthread_mutex_lock)(pthread_mutex_t *) = tx_pthread_mutex_lock;
 int  (*dummy_tx_pthread_mutex_unlock)(pthread_mutex_t *) = tx_pthread_mutex_unlock;
+int  (*dummy_tx_pthread_spin_lock)(pthread_spinlock_t *) = tx_pthread_spin_lock;
+int  (*dummy_tx_pthread_spin_unlock)(pthread_spinlock_t *) = tx_pthread_spin_unlock;
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,62 @@
+#ifndef TX_OUTPUT_H
+#define TX_OUTPUT_H
+
+// Deferred output for Tx runtimes: my_printf & co. (benches/util/libc) call
+// tx_write(); inside Tx, output is appended to a thread-local buffer (and
+// thus discarded together with the Tx on abort) and written out with the
+// real syscall after commit. Each runtime implements tx_write() on top of
+// the helpers below.
+
+#include <errno.h>
+#include <unistd.h>
+
+#ifndef TX_OUTPUT_SIZE
+#define TX_OUTPUT_SIZE 4096
+#endif
+
+struct tx_output_chunk {
+	int fd;
+	unsigned len;
+};
+
+// chunk headers stay aligned
+#define TX_OUTPUT_CHUNK(n) (sizeof(struct tx_output_chunk) + (((n) + 7) & ~7UL))
+
+// buffer holds chunks: header followed by len bytes of data; defined by
+// each runtime
+extern __thread char     __txoutput[TX_OUTPUT_SIZE];
+extern __thread unsigned __txoutlen;
+
+// write out output of committed Tx; must be called outside Tx
+extern void tx_output_flush(void);
+
+// append output of current Tx; returns 0 if it does not fit into buffer
+__attribute__((always_inline))
+static inline int tx_output_append(int fd, const void *buf, unsigned long n) {
+	struct tx_output_chunk *chunk;
+	if (__txoutlen + TX_OUTPUT_CHUNK(n) > TX_OUTPUT_SIZE)
+		return 0;
+
+	chunk = (struct tx_output_chunk *) (__txoutput + __txoutlen);
+	chunk->fd = fd;
+	chunk->len = n;
+	__builtin_memcpy(chunk + 1, buf, n);
+	__txoutlen += TX_OUTPUT_CHUNK(n);
+	return 1;
+}
+
+// write all of buf, retrying on partial writes and EINTR
+__attribute__((always_inline))
+static inline void tx_output_write(int fd, const char *buf, unsigned len) {
+	while (len > 0) {
+		ssize_t r = write(fd, buf, len);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r <= 0)
+			return;
+		buf += r;
+		len -= r;
+	}
+}
+
+#endif /* TX_OUTPUT_H */
@@ -0,0 +1,139 @@
+#ifndef TX_STATS_H
+#define TX_STATS_H
+
+// Transaction statistics of HAFT runtime (build runtime with -D TX_STATS).
+// Applications may include this header and call haft_get_stats() to query
+// counters aggregated over all threads; at exit, per-thread and total
+// counters are dumped as CSV into the file named by $HAFT_STATS_FILE
+// (or TX_STATS_FILE if not set).
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct haft_stats {
+	unsigned long starts;           // Tx start attempts (incl. retries)
+	unsigned long commits;          // committed Txs
+	unsigned long aborts_explicit;  // explicit aborts (incl. ILR detections)
+	unsigned long aborts_conflict;  // data conflicts with other threads
+	unsigned long aborts_capacity;  // Tx footprint exceeded cache
+	unsigned long aborts_other;     // e.g., syscalls, page faults, interrupts
+	unsigned long retries;          // Tx restarts after abort
+	unsigned long fallbacks;        // regions executed non-transactionally
+	unsigned long elided_locks;     // locks elided in committed Txs
+	unsigned long ilr_detections;   // aborts due to ILR check (tx_abort)
+};
+
+// sums counters of all threads into *stats; returns number of threads seen
+int haft_get_stats(struct haft_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+// ------------------------ runtime-only part ------------------------------ //
+#ifdef TX_STATS_RUNTIME
+
+#ifdef TX_STATS
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef TX_STATS_THREADS
+#define TX_STATS_THREADS 256   // threads beyond that share slots
+#endif
+
+#ifndef TX_STATS_FILE
+#define TX_STATS_FILE "haft_stats.csv"
+#endif
+
+// one cache line (or more) per thread, so that counting causes no conflicts
+struct tx_stats_slot {
+	struct haft_stats s;
+} __attribute__((aligned(64)));
+
+struct tx_stats_slot __txstats[TX_STATS_THREADS];
+int __txstatsthreads = 0;
+__thread struct haft_stats *__txmystats = NULL;
+
+__attribute__((always_inline))
+static inline struct haft_stats *tx_stats(void) {
+	if (!__txmystats) {
+		int slot = __sync_fetch_and_add(&__txstatsthreads, 1);
+		__txmystats = &__txstats[slot % TX_STATS_THREADS].s;
+	}
+	return __txmystats;
+}
+
+#define TX_STAT_INC(field) (tx_stats()->field++)
+
+int haft_get_stats(struct haft_stats *stats) {
+	int i, nthreads = __txstatsthreads;
+	if (nthreads > TX_STATS_THREADS)
+		nthreads = TX_STATS_THREADS;
+
+	struct haft_stats total = {0};
+	for (i = 0; i < nthreads; i++) {
+		struct haft_stats *s = &__txstats[i].s;
+		total.starts          += s->starts;
+		total.commits         += s->commits;
+		total.aborts_explicit += s->aborts_explicit;
+		total.aborts_conflict += s->aborts_conflict;
+		total.aborts_capacity += s->aborts_capacity;
+		total.aborts_other    += s->aborts_other;
+		total.retries         += s->retries;
+		total.fallbacks       += s->fallbacks;
+		total.elided_locks    += s->elided_locks;
+		total.ilr_detections  += s->ilr_detections;
+	}
+	*stats = total;
+	return __txstatsthreads;
+}
+
+static void tx_stats_print(FILE *f, const char *name, struct haft_stats *s) {
+	fprintf(f, "%s,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu\n", name,
+		s->starts, s->commits, s->aborts_explicit, s->aborts_conflict,
+		s->aborts_capacity, s->aborts_other, s->retries, s->fallbacks,
+		s->elided_locks, s->ilr_detections);
+}
+
+__attribute__((destructor))
+void tx_stats_dump(void) {
+	int i, nthreads;
+	char name[32];
+	struct haft_stats total;
+	const char *path = getenv("HAFT_STATS_FILE");
+	FILE *f = fopen(path ? path : TX_STATS_FILE, "w");
+	if (!f)
+		return;
+
+	nthreads = haft_get_stats(&total);
+	if (nthreads > TX_STATS_THREADS)
+		nthreads = TX_STATS_THREADS;
+
+	fprintf(f, "thread,starts,commits,aborts_explicit,aborts_conflict,aborts_capacity,"
+	           "aborts_other,retries,fallbacks,elided_locks,ilr_detections\n");
+	for (i = 0; i < nthreads; i++) {
+		snprintf(name, sizeof(name), "%d", i);
+		tx_stats_print(f, name, &__txstats[i].s);
+	}
+	tx_stats_print(f, "total", &total);
+	fclose(f);
+}
+
+#else
+
+#define TX_STAT_INC(field) ((void)0)
+
+// statistics are not collected, report nothing
+int haft_get_stats(struct haft_stats *stats) {
+	struct haft_stats none = {0};
+	*stats = none;
+	return 0;
+}
+
+#endif /* TX_STATS */
+
+#endif /* TX_STATS_RUNTIME */
+
+#endif /* TX_STATS_H */
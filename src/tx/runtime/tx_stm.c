@@ -0,0 +1,328 @@
+// Software fallback for machines without HTM: Tx start takes a checkpoint
+// in the frame of the function starting the Tx (registers via setjmp +
+// snapshot of that frame), the Tx pass logs old values before each store
+// (-tx-undo-log), and tx_abort (called by ILR checks from
+// ilr.ll.checks-stm) rolls memory back and re-executes from Tx start.
+//
+// NOTE: provides recovery, not isolation -- rollback is correct only for
+//       data-race-free programs; lock wrappers therefore commit the current
+//       Tx and use real locks.
+// NOTE: tx_start and tx_cond_start are always_inline and returns_twice, so
+//       setjmp runs in the frame of their caller, which stays live until
+//       rollback: the Tx pass calls tx_return before each return, which
+//       commits Tx when its checkpoint frame is left.
+// NOTE: the frame is found via frame pointers (Makefile.common adds
+//       -fno-omit-frame-pointer); without them, TX_STACK_WINDOW bytes above
+//       Tx start are snapshotted instead.
+#define _GNU_SOURCE
+#include <alloca.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tx_config.h"
+
+#define TX_STATS_RUNTIME
+#include "tx_stats.h"
+#include "tx_output.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// bytes of undo log per thread; Tx that overflows it is not recoverable
+#ifndef TX_UNDO_LOG_SIZE
+#define TX_UNDO_LOG_SIZE (1 << 20)
+#endif
+
+// max bytes of stack (above Tx start) restored on rollback
+#ifndef TX_STACK_WINDOW
+#define TX_STACK_WINDOW (16 << 10)
+#endif
+
+#ifdef TX_ILR_SIGNATURE
+// ILR runtime: verifies signature of folded checks, aborts Tx on mismatch;
+// signature is updated by inlined accumulators after the Tx pass, so its
+// stores are not undo-logged and it is reset explicitly
+extern void SWIFT$verify(void);
+extern __thread unsigned long SWIFT$signature;
+#endif
+
+// thread-local dynamic counter (implemented as mov %fs:0xfc,%rax)
+__thread long __txinstcounter = -1;
+__thread long __txfootprint = -1;
+
+// undo log entry: old bytes (8-byte aligned) followed by address and size,
+// so that the log can be walked backwards
+struct tx_undo_entry {
+	char *addr;
+	unsigned long size;
+};
+
+__thread int     __txactive = 0;     // inside software Tx?
+__thread int     __txoverflow = 0;   // undo log overflowed, cannot roll back
+__thread int     __txaborts = 0;     // rollbacks of current Tx
+__thread jmp_buf __txenv;            // registers at Tx start
+__thread char   *__txlog = NULL;
+__thread unsigned long __txlogpos = 0;
+__thread char   *__txstack = NULL;   // snapshot of [__txstacklo, __txstackhi)
+__thread char   *__txstacklo = NULL;
+__thread char   *__txstackhi = NULL;
+__thread char   *__txstacktop = NULL;
+__thread char   *__txstackbottom = NULL;
+__thread char   *__txframe = NULL;   // frame holding checkpoint of Tx
+
+// deferred output of Tx, see tx_output.h
+__thread char     __txoutput[TX_OUTPUT_SIZE];
+__thread unsigned __txoutlen = 0;
+
+__attribute__((noinline))
+void tx_output_flush(void) {
+	unsigned pos = 0;
+	while (pos < __txoutlen) {
+		struct tx_output_chunk *chunk = (struct tx_output_chunk *) (__txoutput + pos);
+		tx_output_write(chunk->fd, (const char *) (chunk + 1), chunk->len);
+		pos += TX_OUTPUT_CHUNK(chunk->len);
+	}
+	__txoutlen = 0;
+}
+
+__attribute__((always_inline))
+static inline void tx_stm_init_thread(void) {
+	pthread_attr_t attr;
+	void *addr;
+	size_t size;
+
+	if (__txlog)
+		return;
+	__txlog = (char *) malloc(TX_UNDO_LOG_SIZE);
+	__txstack = (char *) malloc(TX_STACK_WINDOW);
+
+	pthread_getattr_np(pthread_self(), &attr);
+	pthread_attr_getstack(&attr, &addr, &size);
+	pthread_attr_destroy(&attr);
+	__txstackbottom = (char *) addr;
+	__txstacktop = (char *) addr + size;
+}
+
+// address below the frame of the caller (stack grows down)
+__attribute__((noinline))
+char *tx_stm_stack_low(void) {
+	return (char *) __builtin_frame_address(0);
+}
+
+// inlined into the function starting the Tx: its frame holds checkpoint
+__attribute__((always_inline, returns_twice))
+void tx_start(int site) {
+	(void) site;
+	tx_stm_init_thread();
+
+	TX_STAT_INC(starts);
+	__txlogpos = 0;
+	__txoverflow = 0;
+#ifdef TX_ILR_SIGNATURE
+	SWIFT$signature = 0;
+#endif
+
+	if (setjmp(__txenv)) {
+		// second return: memory and stack were rolled back by tx_abort
+		TX_STAT_INC(retries);
+		__txinstcounter = __txconfig.threshold;
+		__txfootprint = __txconfig.footprint_threshold;
+		return;
+	}
+
+	// snapshot current frame (spill slots, allocas): it ends after saved
+	// frame pointer and return address
+	__txframe = (char *) __builtin_frame_address(0);
+	__txstacklo = tx_stm_stack_low();
+	__txstackhi = __txframe + 2 * sizeof(void *);
+	if (__txstackhi <= __txstacklo || __txstackhi > __txstacklo + TX_STACK_WINDOW) {
+		// no frame pointer, fall back to fixed window
+		__txstackhi = __txstacklo + TX_STACK_WINDOW;
+	}
+	if (__txstackhi > __txstacktop)
+		__txstackhi = __txstacktop;
+	memcpy(__txstack, __txstacklo, __txstackhi - __txstacklo);
+
+	__txactive = 1;
+	__txinstcounter = __txconfig.threshold;
+	__txfootprint = __txconfig.footprint_threshold;
+}
+
+__attribute__((always_inline))
+void tx_end(void) {
+#ifdef TX_ILR_SIGNATURE
+	SWIFT$verify();
+#endif
+	if (__txactive) {
+		__txactive = 0;
+		__txaborts = 0;
+		__txlogpos = 0;
+		TX_STAT_INC(commits);
+		if (__txoutlen)
+			tx_output_flush();
+	}
+}
+
+__attribute__((always_inline, returns_twice))
+void tx_cond_start(int site) {
+  if (__txinstcounter > 0 && __txfootprint > 0)
+    return;
+  tx_end();
+  tx_start(site);
+}
+
+// called by Tx pass before each return of function with Tx boundaries:
+// Tx cannot be rolled back once frame holding its checkpoint is gone, so
+// commit it; next conditional Tx start in caller begins a new Tx
+__attribute__((always_inline))
+void tx_return(void) {
+	if (__txactive && __txframe == (char *) __builtin_frame_address(0)) {
+		tx_end();
+		__txinstcounter = 0;
+	}
+}
+
+// called by Tx pass before each store to memory
+__attribute__((always_inline))
+void tx_undo_log(void *ptr, unsigned long size) {
+	char *addr = (char *) ptr;
+	if (!__txactive || __txoverflow)
+		return;
+	// snapshot is restored anyway, and frames below it are dead after
+	// rollback (and may be in use by tx_abort, so must not be written)
+	if (addr >= __txstackbottom && addr + size <= __txstackhi)
+		return;
+
+	unsigned long entrysize = sizeof(struct tx_undo_entry) + ((size + 7) & ~7UL);
+	if (__txlogpos + entrysize > TX_UNDO_LOG_SIZE) {
+		// cannot roll back anymore, end this Tx as soon as possible
+		__txoverflow = 1;
+		__txinstcounter = 0;
+		return;
+	}
+
+	char *data = __txlog + __txlogpos;
+	struct tx_undo_entry *e = (struct tx_undo_entry *) (data + entrysize - sizeof(struct tx_undo_entry));
+	memcpy(data, addr, size);
+	e->addr = addr;
+	e->size = size;
+	__txlogpos += entrysize;
+}
+
+// undo stores, restore snapshot and jump to Tx start; must run below the
+// snapshot -- logged stack addresses all lie above it, so our own frames
+// are never overwritten
+__attribute__((noinline, noreturn))
+void tx_stm_rollback(void) {
+	char *end;
+
+	// undo stores in reverse order
+	end = __txlog + __txlogpos;
+	while (end > __txlog) {
+		struct tx_undo_entry *e = (struct tx_undo_entry *) (end - sizeof(struct tx_undo_entry));
+		char *data = (char *) e - ((e->size + 7) & ~7UL);
+		memcpy(e->addr, data, e->size);
+		end = data;
+	}
+	__txlogpos = 0;
+	__txoutlen = 0;  // discard output of aborted Tx
+#ifdef TX_ILR_SIGNATURE
+	SWIFT$signature = 0;  // differences found by aborted Tx
+#endif
+
+	memcpy(__txstacklo, __txstack, __txstackhi - __txstacklo);
+	longjmp(__txenv, 1);
+}
+
+void tx_abort(void) {
+	TX_STAT_INC(aborts_explicit);
+	TX_STAT_INC(ilr_detections);
+	if (!__txactive || __txoverflow || __txaborts >= __txconfig.max_retries) {
+		// not recoverable, caller (ILR check) terminates program
+		TX_STAT_INC(fallbacks);
+		return;
+	}
+	__txaborts++;
+
+	// move our stack frame below the snapshot before rolling back
+	char *sp = tx_stm_stack_low();
+	if (sp > __txstacklo - 4096) {
+		volatile char *pad = (char *) alloca(sp - __txstacklo + 4096);
+		pad[0] = 0;
+	}
+	tx_stm_rollback();
+}
+
+__attribute__((always_inline))
+int tx_threshold_exceeded(void) {
+  if (__txinstcounter > 0 && __txfootprint > 0)
+    return 0;
+  return 1;
+}
+
+__attribute__((always_inline))
+void tx_increment(unsigned long inc, unsigned long lines) {
+  __txinstcounter -= (long)inc;
+  __txfootprint -= (long)lines;
+}
+
+// pthread lock/unlock wrappers: no elision in software, commit and lock;
+// next conditional Tx start begins a new Tx
+int tx_pthread_mutex_lock(pthread_mutex_t *m) {
+  tx_end();
+  __txinstcounter = 0;
+  return pthread_mutex_lock(m);
+}
+
+int tx_pthread_mutex_unlock(pthread_mutex_t *m) {
+  tx_end();
+  __txinstcounter = 0;
+  return pthread_mutex_unlock(m);
+}
+
+int tx_pthread_spin_lock(pthread_spinlock_t *l) {
+  tx_end();
+  __txinstcounter = 0;
+  return pthread_spin_lock(l);
+}
+
+int tx_pthread_spin_unlock(pthread_spinlock_t *l) {
+  tx_end();
+  __txinstcounter = 0;
+  return pthread_spin_unlock(l);
+}
+
+// deferred output of my_printf & co., see tx_output.h
+long tx_write(int fd, const void *buf, unsigned long n) {
+  if (__txactive && !tx_output_append(fd, buf, n)) {
+    // does not fit into buffer, commit Tx and write directly;
+    // next conditional Tx start begins a new Tx
+    tx_end();
+    __txinstcounter = 0;
+  } else if (__txactive) {
+    return n;
+  }
+  return write(fd, buf, n);
+}
+
+// dummy vars, so that LLVM does not optimize function declarations away
+void (*dummy_tx_start_var)(int) = tx_start;
+void (*dummy_tx_cond_start_var)(int) = tx_cond_start;
+void (*dummy_tx_end_var)(void)   = tx_end;
+void (*dummy_tx_abort_var)(void) = tx_abort;
+int  (*dummy_tx_threshold_exceeded_var)(void) = tx_threshold_exceeded;
+void (*dummy_tx_increment_var)(unsigned long, unsigned long) = tx_increment;
+long (*dummy_tx_write_var)(int, const void *, unsigned long) = tx_write;
+void (*dummy_tx_undo_log_var)(void *, unsigned long) = tx_undo_log;
+void (*dummy_tx_return_var)(void) = tx_return;
+int  (*dummy_tx_pthread_mutex_lock)(pthread_mutex_t *) = tx_pthread_mutex_lock;
+int  (*dummy_tx_pthread_mutex_unlock)(pthread_mutex_t *) = tx_pthread_mutex_unlock;
+int  (*dummy_tx_pthread_spin_lock)(pthread_spinlock_t *) = tx_pthread_spin_lock;
+int  (*dummy_tx_pthread_spin_unlock)(pthread_spinlock_t *) = tx_pthread_spin_unlock;
+
+#ifdef __cplusplus
+}
+#endif